@@ -0,0 +1,326 @@
+// `make check`: protocol tests for AdbClient. Most cases run against
+// bench/fakeadb (OKAY/FAIL status, length-prefixed host replies, transport
+// switching to exec:/shell:/sync: services, a device that goes offline).
+// Malformed, truncated and stalled replies come from one-shot servers in
+// this process, which fakeadb never produces.
+#include "adbclient.h"
+
+#include <arpa/inet.h>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <netinet/in.h>
+#include <string>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+    using Clock = std::chrono::steady_clock;
+
+    const int kDefaultAdbPort = 15038;
+    const int kServerStartMs = 5000;
+
+    int failures = 0;
+
+    void check(bool ok, const std::string& name, const std::string& detail = "") {
+        if (ok) {
+            std::cout << "ok    " << name << std::endl;
+        } else {
+            ++failures;
+            std::cout << "FAIL  " << name << (detail.empty() ? "" : ": " + detail) << std::endl;
+        }
+    }
+
+    std::string describe(AdbStatus status, const AdbClient& client) {
+        return std::string(toString(status)) + " (" + client.lastError() + ")";
+    }
+
+    void writeFile(const std::string& path, const std::string& text) {
+        std::ofstream(path) << text;
+    }
+
+    void setDeviceUp(const std::string& state, bool up) {
+        writeFile(state + "/session", up ? "RUNNING\n" : "STOPPED\n");
+        writeFile(state + "/container", up ? "RUNNING\n" : "STOPPED\n");
+    }
+
+    bool canConnect(int port) {
+        int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0) return false;
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(static_cast<uint16_t>(port));
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        bool ok = connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0;
+        close(fd);
+        return ok;
+    }
+
+    // Serves a single connection on an ephemeral loopback port with `serve`
+    class OneShotServer {
+    private:
+        int listener = -1;
+        int port = 0;
+        std::thread thread;
+
+    public:
+        explicit OneShotServer(std::function<void(int)> serve) {
+            listener = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+            sockaddr_in addr{};
+            addr.sin_family = AF_INET;
+            addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            socklen_t len = sizeof(addr);
+            if (listener < 0 || bind(listener, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 ||
+                listen(listener, 1) != 0 || getsockname(listener, reinterpret_cast<sockaddr*>(&addr), &len) != 0) {
+                std::cerr << "Cannot listen on loopback: " << std::strerror(errno) << std::endl;
+                std::exit(1);
+            }
+            port = ntohs(addr.sin_port);
+            thread = std::thread([this, serve] {
+                int fd = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+                if (fd < 0) return;
+                serve(fd);
+                close(fd);
+            });
+        }
+
+        ~OneShotServer() {
+            shutdown(listener, SHUT_RDWR);
+            thread.join();
+            close(listener);
+        }
+
+        OneShotServer(const OneShotServer&) = delete;
+        OneShotServer& operator=(const OneShotServer&) = delete;
+
+        int getPort() const { return port; }
+    };
+
+    // Reads the 4-hex-digit length and the request, like an adb server
+    void skipRequest(int fd) {
+        char header[5] = {0};
+        if (recv(fd, header, 4, MSG_WAITALL) != 4) return;
+        std::vector<char> request(std::strtoul(header, nullptr, 16) + 1);
+        recv(fd, request.data(), request.size() - 1, MSG_WAITALL);
+    }
+
+    void reply(int fd, const std::string& data) {
+        send(fd, data.data(), data.size(), MSG_NOSIGNAL);
+    }
+
+    void testHostServices(AdbClient& client, const std::string& state, const std::string& serial) {
+        AdbStatus status = client.startServer();
+        check(status == AdbStatus::Ok, "host:version answers OKAY with a length-prefixed reply",
+              describe(status, client));
+
+        setDeviceUp(state, false);
+        std::string value = "stale";
+        status = client.getState(serial, value);
+        check(status == AdbStatus::Failed && client.lastError() == "device offline" && value.empty(),
+              "get-state of an offline device answers FAIL with its message", describe(status, client));
+
+        // OKAY, but the length-prefixed reply says the connection failed
+        status = client.connectDevice(serial);
+        check(status == AdbStatus::Failed && client.lastError().find("failed to connect") != std::string::npos,
+              "host:connect failure inside an OKAY reply", describe(status, client));
+
+        setDeviceUp(state, true);
+        status = client.connectDevice(serial);
+        check(status == AdbStatus::Ok, "host:connect to a running device", describe(status, client));
+
+        status = client.getState(serial, value);
+        check(status == AdbStatus::Ok && value == "device", "get-state of a running device",
+              describe(status, client) + " state '" + value + "'");
+
+        status = client.disconnectDevice(serial);
+        check(status == AdbStatus::Ok, "host:disconnect", describe(status, client));
+    }
+
+    void testTransport(AdbClient& client, const std::string& state, const std::string& serial) {
+        std::string output;
+        AdbStatus status = client.exec(serial, "echo exec-stream", &output);
+        check(status == AdbStatus::Ok && output == "exec-stream\n", "transport switch then exec: until EOF",
+              describe(status, client) + " output '" + output + "'");
+
+        output.clear();
+        status = client.shell(serial, "printf '%s' shell; printf '%s' -stream", &output);
+        check(status == AdbStatus::Ok && output == "shell-stream", "transport switch then shell: until EOF",
+              describe(status, client) + " output '" + output + "'");
+
+        // The raw stream stays usable in both directions
+        int fd = -1;
+        status = client.openService(serial, "exec:sh", fd);
+        bool echoed = false;
+        if (status == AdbStatus::Ok) {
+            const std::string script = "echo round-trip; exit\n";
+            send(fd, script.data(), script.size(), MSG_NOSIGNAL);
+            std::string received;
+            char buf[256];
+            ssize_t n;
+            while ((n = recv(fd, buf, sizeof(buf), 0)) > 0) received.append(buf, static_cast<size_t>(n));
+            echoed = received == "round-trip\n";
+            close(fd);
+        }
+        check(status == AdbStatus::Ok && echoed, "openService gives the raw stream", describe(status, client));
+
+        status = client.openService(serial, "bogus:", fd);
+        check(status == AdbStatus::Failed && fd == -1 &&
+                  client.lastError().find("unsupported service") != std::string::npos,
+              "FAIL for the service after the transport switch", describe(status, client));
+
+        // fakeadb has no sync: service, so the push fails at the service
+        status = client.push(serial, "/proc/self/exe", "/data/local/tmp/test");
+        check(status == AdbStatus::Failed, "push reports a refused sync:", describe(status, client));
+
+        setDeviceUp(state, false);
+        status = client.exec(serial, "true");
+        check(status == AdbStatus::Failed && client.lastError() == "device offline",
+              "FAIL for the transport of an offline device", describe(status, client));
+        setDeviceUp(state, true);
+    }
+
+    // One client shared by several threads, as Waydroid does
+    void testConcurrentUse(AdbClient& client, const std::string& serial) {
+        std::atomic<int> wrong{0};
+        std::vector<std::thread> threads;
+        for (int t = 0; t < 4; ++t) {
+            threads.emplace_back([&client, &serial, &wrong, t] {
+                for (int i = 0; i < 10; ++i) {
+                    std::string expected = std::to_string(t) + "-" + std::to_string(i);
+                    std::string output;
+                    if (client.exec(serial, "echo " + expected, &output) != AdbStatus::Ok ||
+                        output != expected + "\n") {
+                        ++wrong;
+                    }
+                    // Failures from other threads only ever replace lastError()
+                    int fd = -1;
+                    client.openService(serial, "bogus:" + expected, fd);
+                }
+            });
+        }
+        for (auto& thread : threads) thread.join();
+        check(wrong == 0, "one client shared by four threads", std::to_string(wrong) + " wrong replies");
+    }
+
+    void testMalformedReplies() {
+        {
+            OneShotServer server([](int fd) {
+                skipRequest(fd);
+                reply(fd, "WHAT");
+            });
+            AdbClient client("127.0.0.1", server.getPort());
+            AdbStatus status = client.startServer();
+            check(status == AdbStatus::ProtocolError, "unknown status word", describe(status, client));
+        }
+        {
+            OneShotServer server([](int fd) {
+                skipRequest(fd);
+                reply(fd, "OKAYzz01x");
+            });
+            AdbClient client("127.0.0.1", server.getPort());
+            AdbStatus status = client.startServer();
+            check(status == AdbStatus::ProtocolError, "non-hex reply length", describe(status, client));
+        }
+        {
+            OneShotServer server([](int fd) {
+                skipRequest(fd);
+                reply(fd, "OKAY0010short");
+            });
+            AdbClient client("127.0.0.1", server.getPort());
+            AdbStatus status = client.startServer();
+            check(status == AdbStatus::IoError, "reply shorter than its length", describe(status, client));
+        }
+        {
+            OneShotServer server([](int fd) {
+                skipRequest(fd);
+                reply(fd, "FAIL000cno such host");
+            });
+            AdbClient client("127.0.0.1", server.getPort());
+            AdbStatus status = client.startServer();
+            check(status == AdbStatus::Failed && client.lastError() == "no such host", "FAIL message",
+                  describe(status, client));
+        }
+    }
+
+    void testStalledServer() {
+        // Accepts and reads the request, then never answers
+        std::atomic<bool> release{false};
+        OneShotServer server([&release](int fd) {
+            skipRequest(fd);
+            while (!release) std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        });
+        AdbClient client("127.0.0.1", server.getPort());
+        client.setIoTimeout(300);
+        auto begin = Clock::now();
+        std::string state;
+        AdbStatus status = client.getState("stalled", state);
+        long long ms = std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - begin).count();
+        release = true;
+        check(status == AdbStatus::IoError && ms < 2000, "a stalled server times out",
+              describe(status, client) + " after " + std::to_string(ms) + " ms");
+    }
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        std::cerr << "Usage: " << argv[0] << " <fakeadb> [adb port]" << std::endl;
+        return 2;
+    }
+    const std::string fakeadb = argv[1];
+    const int port = argc > 2 ? std::atoi(argv[2]) : kDefaultAdbPort;
+    const std::string serial = "192.168.240.112:5555";
+    signal(SIGPIPE, SIG_IGN);
+
+    char dirTemplate[] = "/tmp/waypi-adbtest.XXXXXX";
+    if (!mkdtemp(dirTemplate)) {
+        std::cerr << "Cannot create a state directory: " << std::strerror(errno) << std::endl;
+        return 1;
+    }
+    const std::string state = dirTemplate;
+    setDeviceUp(state, false);
+
+    // Device commands run the host's sh, so an empty stand-in directory will do
+    pid_t server = fork();
+    if (server == 0) {
+        execl(fakeadb.c_str(), fakeadb.c_str(), std::to_string(port).c_str(), state.c_str(), state.c_str(),
+              static_cast<char*>(nullptr));
+        _exit(127);
+    }
+    auto deadline = Clock::now() + std::chrono::milliseconds(kServerStartMs);
+    while (!canConnect(port) && Clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    }
+    if (!canConnect(port)) {
+        std::cerr << "fakeadb did not listen on port " << port << std::endl;
+        kill(server, SIGTERM);
+        waitpid(server, nullptr, 0);
+        return 1;
+    }
+
+    AdbClient client("127.0.0.1", port);
+    testHostServices(client, state, serial);
+    testTransport(client, state, serial);
+    testConcurrentUse(client, serial);
+    testMalformedReplies();
+    testStalledServer();
+
+    kill(server, SIGTERM);
+    waitpid(server, nullptr, 0);
+    for (const char* name : {"session", "container"}) unlink((state + "/" + name).c_str());
+    rmdir(state.c_str());
+
+    std::cout << std::endl << (failures == 0 ? "All adb protocol tests passed" :
+                               std::to_string(failures) + " adb protocol test(s) failed") << std::endl;
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,272 @@
+// Stand-in adb server and key injector for `make bench`.
+// Speaks enough of the smart-socket protocol for AdbClient: host:version,
+// connect/disconnect, get-state and transport services. exec:/shell: streams
+// run the host's /bin/sh with bench/device first on PATH, so device commands
+// hit the recording stand-ins. The fake container is "up" while the state
+// directory says so. The localabstract: service of the key injector is
+// answered in-process by a fake injector that logs every key instead of
+// injecting it.
+#include "injector/protocol.h"
+
+#include <arpa/inet.h>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <string>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+    std::string stateDir;
+    double keyDelayScale = 1.0;
+    bool injectorEnabled = true;
+    std::mutex keysMtx;
+
+    bool readFully(int fd, void* buf, size_t len) {
+        char* p = static_cast<char*>(buf);
+        while (len > 0) {
+            ssize_t n = recv(fd, p, len, 0);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return false;
+            p += n;
+            len -= static_cast<size_t>(n);
+        }
+        return true;
+    }
+
+    bool writeFully(int fd, const std::string& data) {
+        size_t off = 0;
+        while (off < data.size()) {
+            ssize_t n = send(fd, data.data() + off, data.size() - off, MSG_NOSIGNAL);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return false;
+            off += static_cast<size_t>(n);
+        }
+        return true;
+    }
+
+    std::string hex4(size_t n) {
+        char buf[5];
+        std::snprintf(buf, sizeof(buf), "%04zx", n);
+        return buf;
+    }
+
+    bool okay(int fd, const std::string* payload = nullptr) {
+        std::string reply = "OKAY";
+        if (payload) reply += hex4(payload->size()) + *payload;
+        return writeFully(fd, reply);
+    }
+
+    bool failure(int fd, const std::string& message) {
+        return writeFully(fd, "FAIL" + hex4(message.size()) + message);
+    }
+
+    bool readRequest(int fd, std::string& request) {
+        char header[5] = {0};
+        if (!readFully(fd, header, 4)) return false;
+        char* end = nullptr;
+        unsigned long len = std::strtoul(header, &end, 16);
+        if (end != header + 4 || len > 65536) return false;
+        request.assign(len, '\0');
+        return len == 0 || readFully(fd, &request[0], len);
+    }
+
+    std::string readState(const char* name) {
+        std::ifstream in(stateDir + "/" + name);
+        std::string value;
+        std::getline(in, value);
+        return value;
+    }
+
+    // adbd answers only while the container runs (not frozen)
+    bool deviceUp() {
+        return readState("session") == "RUNNING" && readState("container") == "RUNNING";
+    }
+
+    void serveInjector(int fd);
+
+    void runService(int fd, const std::string& service) {
+        if (service == std::string("localabstract:") + InjectorProtocol::kSocketName) {
+            if (!injectorEnabled) {
+                failure(fd, "cannot connect to " + service);
+            } else if (okay(fd)) {
+                serveInjector(fd);
+                return;
+            }
+            close(fd);
+            return;
+        }
+
+        std::string command;
+        if (service.compare(0, 5, "exec:") == 0) command = service.substr(5);
+        else if (service.compare(0, 6, "shell:") == 0) command = service.substr(6);
+        else {
+            failure(fd, "unsupported service " + service);
+            close(fd);
+            return;
+        }
+        if (!okay(fd)) {
+            close(fd);
+            return;
+        }
+
+        pid_t pid = fork();
+        if (pid == 0) {
+            dup2(fd, STDIN_FILENO);
+            dup2(fd, STDOUT_FILENO);
+            int null = open("/dev/null", O_WRONLY);
+            if (null >= 0) dup2(null, STDERR_FILENO);
+            // "sh" is the interactive stream AdbShell uses
+            if (command == "sh") execl("/bin/sh", "sh", static_cast<char*>(nullptr));
+            else execl("/bin/sh", "sh", "-c", command.c_str(), static_cast<char*>(nullptr));
+            _exit(127);
+        }
+        // The stream stays open in the child until the shell exits
+        close(fd);
+        if (pid > 0) waitpid(pid, nullptr, 0);
+    }
+
+    void serveAdb(int fd) {
+        std::string request;
+        while (readRequest(fd, request)) {
+            if (request == "host:version") {
+                std::string version = "0029";
+                okay(fd, &version);
+            } else if (request.compare(0, 13, "host:connect:") == 0) {
+                std::string serial = request.substr(13);
+                std::string reply = deviceUp() ? "connected to " + serial
+                                               : "failed to connect to " + serial;
+                okay(fd, &reply);
+            } else if (request.compare(0, 16, "host:disconnect:") == 0) {
+                std::string reply = "disconnected " + request.substr(16);
+                okay(fd, &reply);
+            } else if (request.compare(0, 12, "host-serial:") == 0 &&
+                       request.size() > 10 && request.compare(request.size() - 10, 10, ":get-state") == 0) {
+                if (deviceUp()) {
+                    std::string state = "device";
+                    okay(fd, &state);
+                } else {
+                    failure(fd, "device offline");
+                }
+            } else if (request.compare(0, 15, "host:transport:") == 0) {
+                if (!deviceUp()) {
+                    failure(fd, "device offline");
+                    break;
+                }
+                okay(fd);
+                // The next request on this socket is the service
+                if (readRequest(fd, request)) {
+                    runService(fd, request);
+                    return;
+                }
+            } else {
+                // sync: included: pushes fail, which the controller tolerates
+                failure(fd, "unsupported request " + request);
+            }
+        }
+        close(fd);
+    }
+
+    void serveInjector(int fd) {
+        while (true) {
+            uint8_t header[4];
+            if (!readFully(fd, header, sizeof(header))) break;
+            if (header[0] != InjectorProtocol::kMagic0 || header[1] != InjectorProtocol::kMagic1) break;
+            unsigned count = (header[2] << 8) | header[3];
+            if (count > InjectorProtocol::kMaxKeys) break;
+
+            std::vector<uint8_t> entries(count * 4);
+            if (count > 0 && !readFully(fd, entries.data(), entries.size())) break;
+
+            long delayMs = 0;
+            {
+                std::lock_guard<std::mutex> lock(keysMtx);
+                std::ofstream log(stateDir + "/keys.log", std::ios::app);
+                for (unsigned i = 0; i < count; ++i) {
+                    unsigned code = (entries[i * 4] << 8) | entries[i * 4 + 1];
+                    delayMs += (entries[i * 4 + 2] << 8) | entries[i * 4 + 3];
+                    log << "injector " << code << "\n";
+                }
+            }
+            // Reply once the keys "were injected", like keyinjectd
+            if (delayMs > 0 && keyDelayScale > 0) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(static_cast<long>(delayMs * keyDelayScale)));
+            }
+            uint8_t status = InjectorProtocol::kStatusOk;
+            if (!writeFully(fd, std::string(reinterpret_cast<char*>(&status), 1))) break;
+        }
+        close(fd);
+    }
+
+    int listenOn(const char* ip, int port) {
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(static_cast<uint16_t>(port));
+        if (inet_pton(AF_INET, ip, &addr.sin_addr) != 1) return -1;
+
+        int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0) return -1;
+        int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if (bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || listen(fd, 16) != 0) {
+            close(fd);
+            return -1;
+        }
+        return fd;
+    }
+
+    void acceptLoop(int listener, void (*serve)(int)) {
+        while (true) {
+            int fd = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+            if (fd < 0) {
+                if (errno == EINTR || errno == ECONNABORTED) continue;
+                break;
+            }
+            int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            std::thread(serve, fd).detach();
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    if (argc < 4) {
+        std::cerr << "Usage: " << argv[0] << " <adb port> <state dir> <device stand-in dir>" << std::endl;
+        return 2;
+    }
+    const int port = std::atoi(argv[1]);
+    stateDir = argv[2];
+    if (const char* scale = std::getenv("BENCH_KEY_DELAY_SCALE")) keyDelayScale = std::atof(scale);
+
+    // Children (the device shells) find the stand-ins first
+    const char* path = std::getenv("PATH");
+    std::string devicePath = std::string(argv[3]) + ":" + (path ? path : "/usr/bin:/bin");
+    setenv("PATH", devicePath.c_str(), 1);
+    setenv("BENCH_STATE", stateDir.c_str(), 1);
+    signal(SIGPIPE, SIG_IGN);
+
+    int adb = listenOn("127.0.0.1", port);
+    if (adb < 0) {
+        std::cerr << "fakeadb: cannot listen on 127.0.0.1:" << port << ": " << std::strerror(errno) << std::endl;
+        return 1;
+    }
+
+    // BENCH_NO_INJECTOR=1 measures the `adb shell input` fallback instead
+    const char* noInjector = std::getenv("BENCH_NO_INJECTOR");
+    injectorEnabled = !noInjector || std::string(noInjector) != "1";
+
+    acceptLoop(adb, serveAdb);
+    return 1;
+}
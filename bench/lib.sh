@@ -0,0 +1,56 @@
+# Shared by the bench stand-ins (sourced, POSIX sh).
+# $BENCH_STATE is the scenario's state directory: the fake container's state
+# (session, container, focus, running) and one log line per call.
+
+BENCH_ROOT=$(cd "${0%/*}/.." && pwd)
+
+bench_get() {
+    cat "$BENCH_STATE/$1" 2>/dev/null
+}
+
+bench_set() {
+    printf '%s\n' "$2" > "$BENCH_STATE/$1"
+}
+
+# Adds a package to the running list
+bench_started() {
+    grep -qx "$1" "$BENCH_STATE/running" 2>/dev/null || printf '%s\n' "$1" >> "$BENCH_STATE/running"
+}
+
+bench_stopped() {
+    grep -vx "$1" "$BENCH_STATE/running" > "$BENCH_STATE/running.tmp" 2>/dev/null
+    mv "$BENCH_STATE/running.tmp" "$BENCH_STATE/running"
+    [ "$(bench_get focus)" = "$1" ] && bench_set focus ""
+}
+
+# Sleeps for the latency of the longest matching entry in latency.conf
+# (or $BENCH_LATENCY). Entries are "<ms> <command words>".
+bench_delay() {
+    conf=${BENCH_LATENCY:-$BENCH_ROOT/latency.conf}
+    [ -r "$conf" ] || return 0
+    call=" $* "
+    delay=0
+    best=0
+    while read -r ms words; do
+        case "$ms" in ''|\#*) continue ;; esac
+        case "$call" in
+            " $words "*)
+                if [ ${#words} -gt $best ]; then
+                    best=${#words}
+                    delay=$ms
+                fi
+                ;;
+        esac
+    done < "$conf"
+    if [ "$delay" -gt 0 ]; then
+        sleep "$((delay / 1000)).$(printf '%03d' $((delay % 1000)))"
+    fi
+}
+
+# bench_call <host|device> <command...>: records the call, then waits out its latency
+bench_call() {
+    log=$1
+    shift
+    printf '%s\n' "$*" >> "$BENCH_STATE/$log.log"
+    bench_delay "$@"
+}
@@ -0,0 +1,376 @@
+// `make bench`: replays scripted terminal input into the controller against
+// the stand-ins in bench/ and reports, per measured step, the wall time, the
+// host processes spawned (waydroid/adb CLI), the commands run in the fake
+// container and the key events injected. Each scenario starts from a stopped
+// container with its own state directory and zap history, so runs are
+// comparable. Latencies come from bench/latency.conf.
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <condition_variable>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <regex>
+#include <string>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+extern char** environ;
+
+namespace {
+    using Clock = std::chrono::steady_clock;
+
+    const int kDefaultAdbPort = 15037;
+    const int kStepTimeoutMs = 120000;
+    const int kExitTimeoutMs = 60000;
+
+    struct Step {
+        std::string input;  // one terminal line
+        std::string expect; // regex on the controller's output
+        const char* label;  // measured step, or nullptr for setup
+        int settleMs = 0;   // pause after the match, before the next step
+    };
+
+    struct Scenario {
+        const char* name;
+        std::vector<Step> steps;
+    };
+
+    // A channel typed right after the start report would still be tuned by
+    // the start itself, outside the zap metrics
+    const int kStartSettleMs = 500;
+
+    // Terminal numbers: 1 = SVT1, 6 = BN, 0 = RTS 1 (EON list position 1),
+    // 5 = BN Muzika (EON list position 223)
+    const std::vector<Scenario> kScenarios = {
+        {"cold-start", {
+            {"N", "Waydroid start finished in", "cold start"},
+        }},
+        {"svt-eon", {
+            {"N", "Waydroid start finished in", nullptr, kStartSettleMs},
+            {"1", "Zap .* -> SVT1:", "SVT1 (SVT cold)"},
+            {"6", "Zap SVT1 -> BN:", "SVT1 -> BN (EON cold)"},
+            {"1", "Zap BN -> SVT1:", "BN -> SVT1 (SVT resume)"},
+            {"6", "Zap SVT1 -> BN:", "SVT1 -> BN (EON resume)"},
+        }},
+        {"eon-1-223", {
+            {"N", "Waydroid start finished in", nullptr, kStartSettleMs},
+            {"0", "Zap .* -> RTS 1:", nullptr},
+            {"5", "Zap RTS 1 -> BN Muzika:", "EON 1 -> 223"},
+        }},
+    };
+
+    struct Counters {
+        long hostSpawns = 0;
+        long deviceCommands = 0;
+        long keyEvents = 0;
+    };
+
+    struct Row {
+        std::string label;
+        long long wallMs = -1;
+        Counters counted;
+    };
+
+    long countLines(const std::string& path) {
+        std::ifstream in(path);
+        long n = 0;
+        std::string line;
+        while (std::getline(in, line)) ++n;
+        return n;
+    }
+
+    Counters readCounters(const std::string& state) {
+        Counters c;
+        c.hostSpawns = countLines(state + "/host.log");
+        c.deviceCommands = countLines(state + "/device.log");
+        c.keyEvents = countLines(state + "/keys.log");
+        return c;
+    }
+
+    void writeFile(const std::string& path, const std::string& content) {
+        std::ofstream(path) << content;
+    }
+
+    std::string selfDir() {
+        char exe[PATH_MAX];
+        ssize_t n = readlink("/proc/self/exe", exe, sizeof(exe) - 1);
+        if (n <= 0) return ".";
+        std::string path(exe, static_cast<size_t>(n));
+        return path.substr(0, path.rfind('/'));
+    }
+
+    bool serverAccepting(int port) {
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(static_cast<uint16_t>(port));
+        inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+        int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0) return false;
+        bool ok = connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0;
+        close(fd);
+        return ok;
+    }
+
+    // Environment of the parent plus `extra` (which wins)
+    std::vector<std::string> environment(const std::vector<std::string>& extra) {
+        std::vector<std::string> env;
+        for (char** e = environ; *e; ++e) {
+            std::string entry = *e;
+            bool overridden = false;
+            for (const auto& x : extra) {
+                if (entry.compare(0, x.find('=') + 1, x, 0, x.find('=') + 1) == 0) overridden = true;
+            }
+            if (!overridden) env.push_back(entry);
+        }
+        env.insert(env.end(), extra.begin(), extra.end());
+        return env;
+    }
+
+    pid_t spawn(const std::vector<std::string>& argv, const std::vector<std::string>& env,
+                int stdinFd, int stdoutFd) {
+        std::vector<char*> args, envp;
+        for (const auto& a : argv) args.push_back(const_cast<char*>(a.c_str()));
+        args.push_back(nullptr);
+        for (const auto& e : env) envp.push_back(const_cast<char*>(e.c_str()));
+        envp.push_back(nullptr);
+
+        pid_t pid = fork();
+        if (pid == 0) {
+            if (stdinFd >= 0) dup2(stdinFd, STDIN_FILENO);
+            if (stdoutFd >= 0) {
+                dup2(stdoutFd, STDOUT_FILENO);
+                dup2(stdoutFd, STDERR_FILENO);
+            }
+            execve(args[0], args.data(), envp.data());
+            _exit(127);
+        }
+        return pid;
+    }
+
+    bool waitExit(pid_t pid, int timeoutMs) {
+        auto deadline = Clock::now() + std::chrono::milliseconds(timeoutMs);
+        while (Clock::now() < deadline) {
+            if (waitpid(pid, nullptr, WNOHANG) == pid) return true;
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        }
+        return false;
+    }
+
+    void stopChild(pid_t pid) {
+        if (pid <= 0) return;
+        kill(pid, SIGTERM);
+        if (!waitExit(pid, 2000)) {
+            kill(pid, SIGKILL);
+            waitpid(pid, nullptr, 0);
+        }
+    }
+
+    // The controller's output, line by line with arrival times
+    class Output {
+    private:
+        std::mutex mtx;
+        std::condition_variable cv;
+        std::vector<std::pair<Clock::time_point, std::string>> lines;
+        bool closed = false;
+        std::thread reader;
+
+    public:
+        Output(int fd, const std::string& logPath) {
+            reader = std::thread([this, fd, logPath] {
+                std::ofstream log(logPath);
+                std::string pending;
+                char buf[4096];
+                ssize_t n;
+                while ((n = read(fd, buf, sizeof(buf))) != 0) {
+                    if (n < 0) {
+                        if (errno == EINTR) continue;
+                        break;
+                    }
+                    log.write(buf, n);
+                    log.flush();
+                    pending.append(buf, static_cast<size_t>(n));
+                    size_t nl;
+                    std::lock_guard<std::mutex> lock(mtx);
+                    while ((nl = pending.find('\n')) != std::string::npos) {
+                        lines.emplace_back(Clock::now(), pending.substr(0, nl));
+                        pending.erase(0, nl + 1);
+                    }
+                    cv.notify_all();
+                }
+                close(fd);
+                std::lock_guard<std::mutex> lock(mtx);
+                closed = true;
+                cv.notify_all();
+            });
+        }
+
+        ~Output() {
+            if (reader.joinable()) reader.join();
+        }
+
+        size_t size() {
+            std::lock_guard<std::mutex> lock(mtx);
+            return lines.size();
+        }
+
+        // Waits for a line from index `from` on matching `pattern`; returns its
+        // arrival time and moves `from` past it
+        bool expect(const std::regex& pattern, size_t& from, int timeoutMs, Clock::time_point& at) {
+            auto deadline = Clock::now() + std::chrono::milliseconds(timeoutMs);
+            std::unique_lock<std::mutex> lock(mtx);
+            while (true) {
+                for (; from < lines.size(); ++from) {
+                    if (std::regex_search(lines[from].second, pattern)) {
+                        at = lines[from].first;
+                        ++from;
+                        return true;
+                    }
+                }
+                if (closed) return false;
+                if (cv.wait_until(lock, deadline) == std::cv_status::timeout && from >= lines.size()) return false;
+            }
+        }
+    };
+
+    bool sendLine(int fd, const std::string& line) {
+        std::string data = line + "\n";
+        return write(fd, data.data(), data.size()) == static_cast<ssize_t>(data.size());
+    }
+
+    bool runScenario(const Scenario& scenario, const std::string& benchDir, const std::string& mainPath,
+                     const std::string& state, int adbPort, std::vector<Row>& rows) {
+        mkdir(state.c_str(), 0755);
+        writeFile(state + "/session", "STOPPED\n");
+        writeFile(state + "/container", "STOPPED\n");
+        writeFile(state + "/focus", "\n");
+        writeFile(state + "/running", "");
+        for (const char* log : {"host.log", "device.log", "keys.log"}) writeFile(state + "/" + log, "");
+
+        std::vector<std::string> env = environment({
+            "BENCH_STATE=" + state,
+            "PATH=" + benchDir + "/bin:" + (std::getenv("PATH") ? std::getenv("PATH") : "/usr/bin:/bin"),
+            "ANDROID_ADB_SERVER_PORT=" + std::to_string(adbPort),
+            "WAYPI_STANDBY_AFTER_MIN=0",
+            "WAYPI_ZAP_HISTORY=" + state + "/zap-history",
+            "WAYPI_METRICS_FILE=" + state + "/zap-metrics.prom",
+            // The fake list has no geometry to get wrong: measure the paged plans
+            "WAYPI_EON_LIST=340:7",
+        });
+
+        int devnull = open("/dev/null", O_RDWR | O_CLOEXEC);
+        pid_t server = spawn({benchDir + "/fakeadb", std::to_string(adbPort), state, benchDir + "/device"},
+                             env, devnull, -1);
+        close(devnull);
+        for (int i = 0; i < 100 && !serverAccepting(adbPort); ++i) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        }
+        if (!serverAccepting(adbPort)) {
+            std::cerr << scenario.name << ": fake adb server did not come up on port " << adbPort << std::endl;
+            stopChild(server);
+            return false;
+        }
+
+        int in[2], out[2];
+        if (pipe2(in, O_CLOEXEC) != 0 || pipe2(out, O_CLOEXEC) != 0) {
+            stopChild(server);
+            return false;
+        }
+        pid_t controller = spawn({mainPath, "--terminal-only"}, env, in[0], out[1]);
+        close(in[0]);
+        close(out[1]);
+
+        bool ok = true;
+        {
+            Output output(out[0], state + "/controller.log");
+            size_t cursor = 0;
+            for (const Step& step : scenario.steps) {
+                Counters before = readCounters(state);
+                cursor = output.size();
+                auto sent = Clock::now();
+                Clock::time_point done;
+                if (!sendLine(in[1], step.input) ||
+                    !output.expect(std::regex(step.expect), cursor, kStepTimeoutMs, done)) {
+                    std::cerr << scenario.name << ": no \"" << step.expect << "\" after input \""
+                              << step.input << "\" (see " << state << "/controller.log)" << std::endl;
+                    ok = false;
+                    break;
+                }
+                if (step.settleMs > 0) std::this_thread::sleep_for(std::chrono::milliseconds(step.settleMs));
+                if (!step.label) continue;
+
+                Counters after = readCounters(state);
+                Row row;
+                row.label = step.label;
+                row.wallMs = std::chrono::duration_cast<std::chrono::milliseconds>(done - sent).count();
+                row.counted.hostSpawns = after.hostSpawns - before.hostSpawns;
+                row.counted.deviceCommands = after.deviceCommands - before.deviceCommands;
+                row.counted.keyEvents = after.keyEvents - before.keyEvents;
+                rows.push_back(row);
+            }
+
+            // K quits; Waydroid is stopped on the way out
+            sendLine(in[1], "K");
+            close(in[1]);
+            if (!waitExit(controller, kExitTimeoutMs)) {
+                std::cerr << scenario.name << ": controller did not exit, killing it" << std::endl;
+                kill(controller, SIGKILL);
+                waitpid(controller, nullptr, 0);
+                ok = false;
+            }
+        }
+        stopChild(server);
+        return ok;
+    }
+}
+
+int main(int argc, char** argv) {
+    signal(SIGPIPE, SIG_IGN);
+    const std::string benchDir = selfDir();
+    const std::string mainPath = benchDir.substr(0, benchDir.rfind('/')) + "/main";
+    const char* portValue = std::getenv("BENCH_ADB_PORT");
+    const int adbPort = portValue ? std::atoi(portValue) : kDefaultAdbPort;
+
+    char tmpl[] = "/tmp/waypi-bench.XXXXXX";
+    if (!mkdtemp(tmpl)) {
+        std::cerr << "Cannot create a state directory: " << std::strerror(errno) << std::endl;
+        return 1;
+    }
+    const std::string root = tmpl;
+
+    // Scenario names on the command line select a subset
+    std::vector<Row> rows;
+    int failures = 0;
+    for (const Scenario& scenario : kScenarios) {
+        bool selected = argc < 2;
+        for (int i = 1; i < argc; ++i) if (scenario.name == std::string(argv[i])) selected = true;
+        if (!selected) continue;
+
+        std::cout << "Running " << scenario.name << "..." << std::endl;
+        if (!runScenario(scenario, benchDir, mainPath, root + "/" + scenario.name, adbPort, rows)) ++failures;
+    }
+
+    std::cout << std::endl << std::left << std::setw(28) << "Step" << std::right
+              << std::setw(10) << "Wall ms" << std::setw(14) << "Host spawns"
+              << std::setw(14) << "Device cmds" << std::setw(12) << "Keyevents" << std::endl;
+    for (const Row& row : rows) {
+        std::cout << std::left << std::setw(28) << row.label << std::right
+                  << std::setw(10) << row.wallMs << std::setw(14) << row.counted.hostSpawns
+                  << std::setw(14) << row.counted.deviceCommands << std::setw(12) << row.counted.keyEvents << std::endl;
+    }
+    std::cout << std::endl << "Logs and state: " << root << std::endl;
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,36 @@
+#include "App.h"
+#include "deviceprobe.h"
+#include "wait.h"
+#include "traceevents.h"
+#include "log.h"
+
+#include <string>
+
+namespace {
+    // The stream normally starts well within this; past it the zap ends anyway
+    const int kPlaybackTimeoutMs = 10000;
+}
+
+bool App::resume() {
+    const std::string pkg = package();
+    TraceEvents::Span span("app", pkg + ": resume");
+    if (!DeviceProbe::check(adb, DeviceProbe::processAlive(pkg))) {
+        Log::info() << pkg << ": process gone, cold start needed";
+        return false;
+    }
+
+    // A launcher intent moves the existing task to the front instead of restarting it
+    if (adb.run("monkey -p " + pkg + " -c android.intent.category.LAUNCHER 1 >/dev/null 2>&1") != 0) {
+        Log::warn() << pkg << ": could not bring task to front";
+        return false;
+    }
+    // Focus moves here from the other app, so this waits for a real transition
+    const std::string settled = DeviceProbe::settledOn(pkg);
+    Wait::until([&] { return DeviceProbe::check(adb, settled); }, 5000, pkg + ": resume");
+    return true;
+}
+
+/// @brief Ends a zap when the picture is live instead of after a fixed delay
+void App::waitUntilPlaying() {
+    playback.waitForMotion(kPlaybackTimeoutMs, package());
+}
@@ -3,11 +3,33 @@
 #define app_H
 
 #include "channels.h"
+#include "adbshell.h"
+#include "keyinjector.h"
+#include "playbackdetector.h"
 
 class App {
+protected:
+    AdbShell& adb;     // shared session owned by Waydroid
+    KeyInjector& keys; // key path, resident injector or adb input
+    PlaybackDetector playback; // per app: its video may be invisible to screencap
+
 public:
+    App(AdbShell& shell, KeyInjector& injector) : adb(shell), keys(injector), playback(shell) {}
     virtual ~App() = default; // ensure proper deletion via base pointer
+
+    virtual const char* package() const = 0;
+    // Cold start: launch and navigate to the app's current channel
+    virtual void start() = 0;
+    virtual void stop() = 0;
+    virtual bool isRunning() const = 0;
     virtual void setChannel(Channels ch) = 0;
+    virtual Channels getChannel() const = 0;
+
+    // Warm switch: brings the app's existing task to the front, where it is
+    // still playing its last channel. False if Android has killed the process.
+    bool resume();
+    // Blocks until the video moves on screen (bounded; see PlaybackDetector)
+    void waitUntilPlaying();
 };
 
 #endif
@@ -1,37 +1,91 @@
 #include "EON.h"
+#include "../keysequence.h"
+#include "../deviceprobe.h"
+#include "../wait.h"
+#include "../cancel.h"
+#include "../processrunner.h"
+#include "../traceevents.h"
+#include "../log.h"
+#include <cstdio>
 #include <unistd.h>
 
-EON::EON() = default;
+namespace {
+    const char* const kPackage = "com.ug.eon.android.tv";
+    // waydroid app launch returns once the intent is sent
+    const int kLaunchTimeoutMs = 10000;
+
+    // Channel list key model. Only DPAD steps and MOVE_HOME are used by
+    // default: both land on a known row whatever the list looks like. Where
+    // PAGE_* and MOVE_END land depends on the list length and the rows per
+    // page, which have not been measured on the device; a wrong value would
+    // tune the wrong channel with nothing to notice it (the focused row
+    // cannot be read back). Typed numbers do not match list positions (see
+    // channelToAlt), so digit entry stays disabled.
+    NavCostModel listModel() {
+        NavCostModel m;
+        m.listLength = 340; // only bounds DPAD_DOWN while MOVE_END is off
+        m.stepCostMs = 500;
+        m.homeCostMs = 1000;
+        m.digitCostMs = 0;
+
+        // WAYPI_EON_LIST=<rows>:<rows per page>, counted on the device,
+        // enables MOVE_END and PAGE_UP/PAGE_DOWN
+        const char* value = std::getenv("WAYPI_EON_LIST");
+        int rows = 0, pageRows = 0;
+        if (value && std::sscanf(value, "%d:%d", &rows, &pageRows) == 2 && rows > 1 && pageRows > 0) {
+            m.listLength = rows;
+            m.pageSize = pageRows;
+            m.pageCostMs = 800;
+            m.endCostMs = 1000;
+        }
+        return m;
+    }
+}
+
+EON::EON(AdbShell& shell, KeyInjector& injector) : App(shell, injector) {}
 
 EON::~EON() {
     stop();
 }
 
 void EON::start() {
+    TraceEvents::Span span("app", "EON: start");
     // Launch using host waydroid CLI (as requested)
-    system("waydroid app launch com.ug.eon.android.tv");
-    system("waydroid app launch com.ug.eon.android.tv");
-    sleep(9);
+    ProcessRunner::run({"waydroid", "app", "launch", kPackage}, kLaunchTimeoutMs);
+    ProcessRunner::run({"waydroid", "app", "launch", kPackage}, kLaunchTimeoutMs);
+
+    // Continue as soon as the app's first screen is up
+    const std::string settled = DeviceProbe::settledOn(kPackage);
+    Wait::until([&] { return DeviceProbe::check(adb, settled); }, 20000, "EON: launch");
     running = true;
 
-    // Navigate to live stream channel 1
-    std::cout << "EON: Navigating to live TV channel 1" << std::endl;
-    system("adb shell input keyevent KEYCODE_DPAD_CENTER && sleep 3");
-    system("adb shell input keyevent KEYCODE_DPAD_DOWN && sleep 2");
-    system("adb shell input keyevent KEYCODE_DPAD_CENTER && sleep 1");
-    system("adb shell input keyevent KEYCODE_DPAD_CENTER && sleep 1");
-    system("adb shell input keyevent KEYCODE_DPAD_CENTER && sleep 1");
-    system("adb shell input keyevent KEYCODE_DPAD_DOWN && sleep 1");
-    system("adb shell input keyevent KEYCODE_DPAD_CENTER && sleep 1");
-    system("adb shell input keyevent KEYCODE_BACK && sleep 1");
+    // Navigate to live stream channel 1. Screen-changing keys wait until the
+    // screen has changed and settled, with the old fixed delay as the deadline;
+    // focus is already on EON, so settled alone would hold at once
+    Log::info() << "EON: Navigating to live TV channel 1";
+    keys.send(KeySequence()
+            .press(Key::DPAD_CENTER, 300).waitUntilChanged(settled, 3000)
+            .press(Key::DPAD_DOWN, 300)
+            .repeat(Key::DPAD_CENTER, 3, 300).waitUntilChanged(settled, 1000)
+            .press(Key::DPAD_DOWN, 300)
+            .press(Key::DPAD_CENTER, 300).waitUntilChanged(settled, 1000)
+            .press(Key::BACK, 300).waitUntilChanged(settled, 1000),
+        "EON: navigate to channel 1");
+    // A restart after Android killed the app lands on channel 1 again
+    currentChannel = Channels::EON_RTS_1;
 }
 
 void EON::stop() {
-    int rc = system("adb shell am force-stop com.ug.eon.android.tv");
+    TraceEvents::Span span("app", "EON: stop");
+    int rc = adb.run(std::string("am force-stop ") + kPackage);
     (void)rc;
     running = false;
 }
 
+const char* EON::package() const {
+    return kPackage;
+}
+
 bool EON::isRunning() const {
     return running; 
 }
@@ -50,36 +104,61 @@ int EON::channelToAlt(Channels ch) {
     }
 }
 
+NavPlanner EON::planner() {
+    static const NavCostModel model = listModel();
+    return NavPlanner(model);
+}
+
+void EON::printZapCosts(std::ostream& out) {
+    std::vector<std::pair<std::string, int>> channels;
+    for (Channels ch : {Channels::EON_RTS_1, Channels::EON_PINK, Channels::EON_PRVA, Channels::EON_HAPPY,
+                        Channels::EON_BN, Channels::EON_BN_MUZIKA, Channels::EON_NATURE}) {
+        channels.emplace_back(ChannelUtil::name(ch), channelToAlt(ch));
+    }
+    planner().printCostTable(out, channels);
+}
+
 void EON::setChannel(Channels ch) {
+    TraceEvents::Span span("app", std::string("EON: set channel ") + ChannelUtil::name(ch));
     int target = channelToAlt(ch);
     int current = channelToAlt(currentChannel);
 
     if (target < 0) {
-        std::cerr << "Unknown target channel\n";
+        Log::error() << "Unknown target channel";
         return;
     }
     if (current < 0) {
-        std::cerr << "Current channel unknown; refusing to navigate\n";
+        Log::warn() << "Current channel unknown; refusing to navigate";
         return;
     }
 
     int delta = target - current;
-    std::cout << "Changing channel from " << current << " to " << target << " (delta " << delta << ")\n";
+    Log::info() << "Changing channel from " << current << " to " << target << " (delta " << delta << ")";
     if (delta == 0) {
-        std::cout << "Already on target channel\n";
+        Log::info() << "Already on target channel";
         return;
     }
 
-    system("adb shell input keyevent KEYCODE_BACK && sleep 1");
-    for (int i = 0; i < std::abs(delta); ++i) {
-        if (delta > 0) {
-            system("adb shell input keyevent KEYCODE_DPAD_DOWN && sleep 0.5");
-        } else {
-            system("adb shell input keyevent KEYCODE_DPAD_UP && sleep 0.5");
+    NavPlan plan = planner().plan(current, target);
+    Log::info() << "EON: planned " << plan.keyCount << " keys, ~" << plan.costMs << " ms";
+    int status = keys.send(KeySequence()
+            .press(Key::BACK, 1000)
+            .append(plan.keys)
+            .press(Key::DPAD_CENTER, 500).waitUntilChanged(DeviceProbe::settledOn(kPackage), 10000),
+        "EON: change channel");
+
+    if (status != 0) {
+        // Preempted mid-list, or keys were lost: close the list so playback
+        // stays on the old channel, which the next plan starts from. On
+        // cancel, DPAD_CENTER (the last key, carrying a wait) was never sent
+        // (see kCancelled)
+        if (status != KeySequence::kCancelled) {
+            Log::warn() << "EON: channel change to " << target << " failed; staying on " << current;
         }
+        Cancel::Scope uncancellable{Cancel::Token()};
+        keys.press(Key::BACK);
+        return;
     }
-    system("adb shell input keyevent KEYCODE_DPAD_CENTER && sleep 10");
-
     currentChannel = ch;
 }
 
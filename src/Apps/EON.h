@@ -7,24 +7,30 @@
 
 #include "../App.h"
 #include "../channels.h"
+#include "../navplanner.h"
 
 class EON : public App {
 private:
     Channels currentChannel{Channels::EON_RTS_1};
     bool running{false};
 
-    int channelToAlt(Channels ch);
+    static int channelToAlt(Channels ch);
+    static NavPlanner planner();
 
 public:
-    EON();
+    EON(AdbShell& shell, KeyInjector& injector);
     ~EON();
 
-    void start();
-    void stop();
-    bool isRunning() const;
+    const char* package() const override;
+    void start() override;
+    void stop() override;
+    bool isRunning() const override;
 
-    void setChannel(Channels ch);
-    Channels getChannel() const;
+    void setChannel(Channels ch) override;
+    Channels getChannel() const override;
+
+    // Planned vs. DPAD-walk navigation cost between all mapped channels
+    static void printZapCosts(std::ostream& out);
 };
 
 #endif
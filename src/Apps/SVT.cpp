@@ -1,35 +1,64 @@
 #include "SVT.h"
+#include "../keysequence.h"
+#include "../deviceprobe.h"
+#include "../wait.h"
+#include "../cancel.h"
+#include "../processrunner.h"
+#include "../traceevents.h"
+#include "../log.h"
 #include <unistd.h>
 
-SVT::SVT() = default;
+SVT::SVT(AdbShell& shell, KeyInjector& injector) : App(shell, injector) {}
 
 SVT::~SVT() {
     stop();
 }
 
+namespace {
+    const char* const kPackage = "se.svt.android.svtplay";
+    // waydroid app launch returns once the intent is sent
+    const int kLaunchTimeoutMs = 10000;
+}
+
 void SVT::start() {
+    TraceEvents::Span span("app", "SVT: start");
+    // A deep link opens the app straight on the SVT1 live stream
+    if (tuneByIntent(currentChannel)) {
+        running = true;
+        return;
+    }
+
     // Launch using host waydroid CLI (as requested)
-    system("waydroid app launch se.svt.android.svtplay");
-    system("waydroid app launch se.svt.android.svtplay");
-    sleep(3);
+    ProcessRunner::run({"waydroid", "app", "launch", kPackage}, kLaunchTimeoutMs);
+    ProcessRunner::run({"waydroid", "app", "launch", kPackage}, kLaunchTimeoutMs);
+
+    const std::string settled = DeviceProbe::settledOn(kPackage);
+    Wait::until([&] { return DeviceProbe::check(adb, settled); }, 15000, "SVT: launch");
     running = true;
 
-    // Navigate to live stream SVT1
-    system("adb shell input keyevent KEYCODE_DPAD_LEFT && sleep 1");
-    system("adb shell input keyevent KEYCODE_DPAD_CENTER && sleep 5");
-    system("adb shell input keyevent KEYCODE_DPAD_LEFT && sleep 1");
-    system("adb shell input keyevent KEYCODE_DPAD_DOWN && sleep 1");
-    system("adb shell input keyevent KEYCODE_DPAD_DOWN && sleep 1");
-    system("adb shell input keyevent KEYCODE_DPAD_DOWN && sleep 1");
-    system("adb shell input keyevent KEYCODE_DPAD_CENTER && sleep 5");
+    // Navigate to live stream SVT1; screen-changing keys wait for the screen
+    // to change, since focus is already on SVT Play
+    keys.send(KeySequence()
+            .press(Key::DPAD_LEFT, 300)
+            .press(Key::DPAD_CENTER, 300).waitUntilChanged(settled, 5000)
+            .press(Key::DPAD_LEFT, 300)
+            .repeat(Key::DPAD_DOWN, 3, 300)
+            .press(Key::DPAD_CENTER, 300).waitUntilChanged(settled, 5000),
+        "SVT: navigate to SVT1");
+    currentChannel = Channels::SVT1;
 }
 
 void SVT::stop() {
-    int rc = system("adb shell am force-stop se.svt.android.svtplay");
+    TraceEvents::Span span("app", "SVT: stop");
+    int rc = adb.run(std::string("am force-stop ") + kPackage);
     (void)rc;
     running = false;
 }
 
+const char* SVT::package() const {
+    return kPackage;
+}
+
 bool SVT::isRunning() const {
     return running;
 }
@@ -45,33 +74,63 @@ int SVT::channelToAlt(Channels ch) {
     }
 }
 
+// Live stream deep links handled by SVT Play's VIEW intent filter
+const char* SVT::channelUri(Channels ch) {
+    switch (ch) {
+        case Channels::SVT1: return "https://www.svtplay.se/kanaler/svt1";
+        case Channels::SVT2: return "https://www.svtplay.se/kanaler/svt2";
+        case Channels::KUNSKAPSKANALEN: return "https://www.svtplay.se/kanaler/kunskapskanalen";
+        case Channels::SVT24: return "https://www.svtplay.se/kanaler/svt24";
+        default: return nullptr;
+    }
+}
+
+/// @brief Tunes with one `am start` VIEW intent instead of walking the live strip
+/// @return true if the activity manager reported the intent as delivered
+bool SVT::tuneByIntent(Channels ch) {
+    const char* uri = channelUri(ch);
+    if (!uri) return false;
+
+    std::string output;
+    int rc = adb.run(std::string("am start -W -a android.intent.action.VIEW -d ") + uri + " " + kPackage, &output);
+    if (rc != 0 || output.find("Error") != std::string::npos) {
+        Log::warn() << "SVT: intent for " << uri << " failed, falling back to DPAD navigation";
+        return false;
+    }
+
+    Log::info() << "SVT: tuned via intent " << uri;
+    currentChannel = ch;
+    return true;
+}
+
 void SVT::setChannel(Channels ch) {
+    TraceEvents::Span span("app", std::string("SVT: set channel ") + ChannelUtil::name(ch));
     int target = channelToAlt(ch);
     int current = channelToAlt(currentChannel);
 
     if (target < 0) {
-        std::cerr << "Unknown target channel\n";
+        Log::error() << "Unknown target channel";
         return;
     }
     if (current < 0) {
-        std::cerr << "Current channel unknown; refusing to navigate\n";
+        Log::warn() << "Current channel unknown; refusing to navigate";
         return;
     }
 
     int delta = target - current;
     if (delta == 0) {
-        std::cout << "Already on target channel\n";
+        Log::info() << "Already on target channel";
         return;
     }
 
-    for (int i = 0; i < std::abs(delta); ++i) {
-        if (delta > 0) {
-            system("adb shell input keyevent KEYCODE_DPAD_RIGHT && sleep 1");
-        } else {
-            system("adb shell input keyevent KEYCODE_DPAD_LEFT && sleep 1");
-        }
-    }
-    system("adb shell input keyevent KEYCODE_DPAD_CENTER && sleep 1");
+    if (tuneByIntent(ch)) return;
+
+    // The walk moves the cursor from currentChannel; a partial walk would lose track of it
+    Cancel::Scope uncancellable{Cancel::Token()};
+    keys.send(KeySequence()
+            .repeat(delta > 0 ? Key::DPAD_RIGHT : Key::DPAD_LEFT, std::abs(delta), 1000)
+            .press(Key::DPAD_CENTER, 1000),
+        "SVT: change channel");
 
     currentChannel = ch;
 }
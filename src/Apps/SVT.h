@@ -14,17 +14,20 @@ private:
     bool running{false};
 
     int channelToAlt(Channels ch);
+    const char* channelUri(Channels ch);
+    bool tuneByIntent(Channels ch);
 
 public:
-    SVT();
+    SVT(AdbShell& shell, KeyInjector& injector);
     ~SVT();
 
-    void start();
-    void stop();
-    bool isRunning() const;
+    const char* package() const override;
+    void start() override;
+    void stop() override;
+    bool isRunning() const override;
 
-    void setChannel(Channels ch);
-    Channels getChannel() const;
+    void setChannel(Channels ch) override;
+    Channels getChannel() const override;
 };
 
 #endif
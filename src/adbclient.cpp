@@ -0,0 +1,325 @@
+#include "adbclient.h"
+#include "processrunner.h"
+#include "log.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <cstdint>
+#include <chrono>
+#include <utility>
+#include <ctime>
+#include <fcntl.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+namespace {
+    // The first start-server also starts the daemon, which can take a few seconds
+    const int kStartServerTimeoutMs = 15000;
+    // adb connect to an unreachable device takes a few seconds to fail
+    const int kDefaultIoTimeoutMs = 10000;
+    // A server that keeps dying is restarted at most this often
+    const long long kRespawnIntervalMs = 10000;
+
+    long long steadyMs() {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    void setTimeouts(int fd, int timeoutMs) {
+        timeval tv{};
+        tv.tv_sec = timeoutMs / 1000;
+        tv.tv_usec = (timeoutMs % 1000) * 1000;
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    }
+
+    // Also true for a recv/send that hit the socket timeout
+    bool timedOut() {
+        return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINPROGRESS;
+    }
+
+    bool writeFully(int fd, const char* data, size_t len) {
+        while (len > 0) {
+            ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                return false;
+            }
+            data += n;
+            len -= static_cast<size_t>(n);
+        }
+        return true;
+    }
+
+    bool readFully(int fd, char* data, size_t len) {
+        while (len > 0) {
+            ssize_t n = recv(fd, data, len, 0);
+            if (n < 0 && errno == EINTR) continue;
+            if (n == 0) errno = 0; // closed, not timed out
+            if (n <= 0) return false;
+            data += n;
+            len -= static_cast<size_t>(n);
+        }
+        return true;
+    }
+
+    // sync: requests are a 4-byte id followed by a little-endian length or value
+    bool writeSyncHeader(int fd, const char* id, uint32_t value) {
+        unsigned char header[8];
+        std::memcpy(header, id, 4);
+        for (int i = 0; i < 4; ++i) header[4 + i] = static_cast<unsigned char>(value >> (8 * i));
+        return writeFully(fd, reinterpret_cast<const char*>(header), sizeof(header));
+    }
+
+    // false if the stream failed or stalled before EOF
+    bool readToEnd(int fd, std::string* output) {
+        char buf[4096];
+        while (true) {
+            ssize_t n = recv(fd, buf, sizeof(buf), 0);
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0) return false;
+            if (n == 0) return true;
+            if (output) output->append(buf, static_cast<size_t>(n));
+        }
+    }
+}
+
+const char* toString(AdbStatus status) {
+    switch (status) {
+        case AdbStatus::Ok: return "OK";
+        case AdbStatus::ConnectFailed: return "adb server unreachable";
+        case AdbStatus::IoError: return "I/O error";
+        case AdbStatus::ProtocolError: return "protocol error";
+        case AdbStatus::Failed: return "FAIL";
+        default: return "unknown";
+    }
+}
+
+int AdbClient::defaultPort() {
+    const char* value = std::getenv("ANDROID_ADB_SERVER_PORT");
+    int number = value ? std::atoi(value) : 0;
+    return number > 0 && number < 65536 ? number : 5037;
+}
+
+AdbClient::AdbClient(std::string serverHost, int serverPort)
+    : host(std::move(serverHost)), port(serverPort), ioTimeoutMs(kDefaultIoTimeoutMs) {}
+
+AdbStatus AdbClient::fail(AdbStatus status, const std::string& message) {
+    std::lock_guard<std::mutex> lock(errorMtx);
+    error = message;
+    return status;
+}
+
+std::string AdbClient::lastError() const {
+    std::lock_guard<std::mutex> lock(errorMtx);
+    return error;
+}
+
+/// @brief Opens a TCP connection to the adb server, starting it once if needed
+/// @return socket fd, or -1 on failure
+int AdbClient::connectServer() {
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(static_cast<uint16_t>(port));
+    if (inet_pton(AF_INET, host.c_str(), &addr.sin_addr) != 1) {
+        fail(AdbStatus::ConnectFailed, "invalid adb server address " + host);
+        return -1;
+    }
+
+    for (int attempt = 0; attempt < 2; ++attempt) {
+        int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0) {
+            fail(AdbStatus::ConnectFailed, std::strerror(errno));
+            return -1;
+        }
+        // SO_SNDTIMEO bounds connect() too
+        setTimeouts(fd, ioTimeoutMs);
+        if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0) {
+            int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            return fd;
+        }
+        int err = errno;
+        fail(AdbStatus::ConnectFailed, std::strerror(err));
+        close(fd);
+
+        // Server not running: spawn it (off the hot path) and retry, unless
+        // that was just tried; one thread spawns, the others fail this time
+        if (err != ECONNREFUSED) break;
+        long long last = lastSpawnMs;
+        long long now = steadyMs();
+        if ((last != 0 && now - last < kRespawnIntervalMs) || !lastSpawnMs.compare_exchange_strong(last, now)) {
+            break;
+        }
+        Log::info() << "Starting adb server";
+        ProcessRunner::run({"adb", "start-server"}, kStartServerTimeoutMs);
+    }
+    return -1;
+}
+
+AdbStatus AdbClient::sendRequest(int fd, const std::string& request) {
+    char header[5];
+    std::snprintf(header, sizeof(header), "%04zx", request.size());
+    if (!writeFully(fd, header, 4) || !writeFully(fd, request.data(), request.size())) {
+        return fail(AdbStatus::IoError, timedOut() ? "adb server timed out" : std::strerror(errno));
+    }
+    return readStatus(fd);
+}
+
+AdbStatus AdbClient::readStatus(int fd) {
+    char status[4];
+    if (!readFully(fd, status, sizeof(status))) {
+        return fail(AdbStatus::IoError, timedOut() ? "adb server timed out" : "connection closed by adb server");
+    }
+    if (std::memcmp(status, "OKAY", 4) == 0) return AdbStatus::Ok;
+    if (std::memcmp(status, "FAIL", 4) == 0) {
+        std::string message;
+        readLengthPrefixed(fd, message);
+        return fail(AdbStatus::Failed, message);
+    }
+    return fail(AdbStatus::ProtocolError, "unexpected reply " + std::string(status, 4));
+}
+
+AdbStatus AdbClient::readLengthPrefixed(int fd, std::string& out) {
+    char header[5] = {0};
+    if (!readFully(fd, header, 4)) {
+        return fail(AdbStatus::IoError, timedOut() ? "adb server timed out" : "connection closed by adb server");
+    }
+    char* end = nullptr;
+    unsigned long len = std::strtoul(header, &end, 16);
+    if (end != header + 4) {
+        return fail(AdbStatus::ProtocolError, "bad length " + std::string(header, 4));
+    }
+    out.assign(len, '\0');
+    if (len > 0 && !readFully(fd, &out[0], len)) {
+        return fail(AdbStatus::IoError, "short read from adb server");
+    }
+    return AdbStatus::Ok;
+}
+
+AdbStatus AdbClient::hostQuery(const std::string& request, std::string* reply) {
+    int fd = connectServer();
+    if (fd < 0) return AdbStatus::ConnectFailed;
+
+    AdbStatus status = sendRequest(fd, request);
+    if (status == AdbStatus::Ok && reply) {
+        status = readLengthPrefixed(fd, *reply);
+    }
+    close(fd);
+    return status;
+}
+
+AdbStatus AdbClient::startServer() {
+    std::string version;
+    return hostQuery("host:version", &version);
+}
+
+AdbStatus AdbClient::connectDevice(const std::string& serial) {
+    std::string reply;
+    AdbStatus status = hostQuery("host:connect:" + serial, &reply);
+    if (status != AdbStatus::Ok) return status;
+
+    // The server answers OKAY even when the connection attempt failed
+    if (reply.find("connected to") == std::string::npos || reply.find("failed") != std::string::npos) {
+        return fail(AdbStatus::Failed, reply);
+    }
+    return AdbStatus::Ok;
+}
+
+AdbStatus AdbClient::disconnectDevice(const std::string& serial) {
+    std::string reply;
+    return hostQuery("host:disconnect:" + serial, &reply);
+}
+
+AdbStatus AdbClient::getState(const std::string& serial, std::string& state) {
+    state.clear();
+    return hostQuery("host-serial:" + serial + ":get-state", &state);
+}
+
+AdbStatus AdbClient::openService(const std::string& serial, const std::string& service, int& fd) {
+    fd = connectServer();
+    if (fd < 0) return AdbStatus::ConnectFailed;
+
+    AdbStatus status = sendRequest(fd, "host:transport:" + serial);
+    if (status == AdbStatus::Ok) status = sendRequest(fd, service);
+    if (status != AdbStatus::Ok) {
+        close(fd);
+        fd = -1;
+    }
+    return status;
+}
+
+AdbStatus AdbClient::shell(const std::string& serial, const std::string& command, std::string* output) {
+    int fd = -1;
+    AdbStatus status = openService(serial, "shell:" + command, fd);
+    if (status != AdbStatus::Ok) return status;
+    bool complete = readToEnd(fd, output);
+    close(fd);
+    return complete ? AdbStatus::Ok : fail(AdbStatus::IoError, "shell:" + command + " stalled");
+}
+
+AdbStatus AdbClient::exec(const std::string& serial, const std::string& command, std::string* output) {
+    int fd = -1;
+    AdbStatus status = openService(serial, "exec:" + command, fd);
+    if (status != AdbStatus::Ok) return status;
+    bool complete = readToEnd(fd, output);
+    close(fd);
+    return complete ? AdbStatus::Ok : fail(AdbStatus::IoError, "exec:" + command + " stalled");
+}
+
+AdbStatus AdbClient::push(const std::string& serial, const std::string& localPath,
+                          const std::string& remotePath, int mode) {
+    int file = open(localPath.c_str(), O_RDONLY | O_CLOEXEC);
+    if (file < 0) return fail(AdbStatus::IoError, localPath + ": " + std::strerror(errno));
+
+    int fd = -1;
+    AdbStatus status = openService(serial, "sync:", fd);
+    if (status != AdbStatus::Ok) {
+        close(file);
+        return status;
+    }
+
+    std::string target = remotePath + "," + std::to_string(mode);
+    bool ok = writeSyncHeader(fd, "SEND", static_cast<uint32_t>(target.size())) &&
+              writeFully(fd, target.data(), target.size());
+
+    // DATA chunks are limited to 64 KiB by the protocol
+    char chunk[64 * 1024];
+    while (ok) {
+        ssize_t n = read(file, chunk, sizeof(chunk));
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) {
+            close(file);
+            close(fd);
+            return fail(AdbStatus::IoError, localPath + ": " + std::strerror(errno));
+        }
+        if (n == 0) break;
+        ok = writeSyncHeader(fd, "DATA", static_cast<uint32_t>(n)) &&
+             writeFully(fd, chunk, static_cast<size_t>(n));
+    }
+    close(file);
+    ok = ok && writeSyncHeader(fd, "DONE", static_cast<uint32_t>(std::time(nullptr)));
+
+    unsigned char reply[8];
+    if (!ok || !readFully(fd, reinterpret_cast<char*>(reply), sizeof(reply))) {
+        close(fd);
+        return fail(AdbStatus::IoError, "sync transfer to " + remotePath + " interrupted");
+    }
+    uint32_t len = reply[4] | (reply[5] << 8) | (reply[6] << 16) | (static_cast<uint32_t>(reply[7]) << 24);
+    if (std::memcmp(reply, "OKAY", 4) != 0) {
+        std::string message(len, '\0');
+        if (len > 0 && len < 4096) readFully(fd, &message[0], len);
+        close(fd);
+        return fail(AdbStatus::Failed, message);
+    }
+
+    writeSyncHeader(fd, "QUIT", 0);
+    close(fd);
+    return AdbStatus::Ok;
+}
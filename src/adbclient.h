@@ -0,0 +1,70 @@
+// In-process client for the adb server's smart-socket protocol (localhost:5037)
+// Each request opens its own server socket, so one client may be used from
+// several threads; lastError() is then the most recent failure of any of them.
+// Every socket gets send/receive timeouts, so a wedged server fails requests
+// with IoError instead of blocking their callers.
+#ifndef ADBCLIENT_H
+#define ADBCLIENT_H
+
+#include <atomic>
+#include <mutex>
+#include <string>
+
+enum class AdbStatus {
+    Ok,
+    ConnectFailed,  // adb server unreachable
+    IoError,        // socket error or short read/write
+    ProtocolError,  // malformed reply from the server
+    Failed          // server answered FAIL (message in lastError())
+};
+
+class AdbClient {
+private:
+    std::string host;
+    int port;
+    std::atomic<int> ioTimeoutMs;
+    std::atomic<long long> lastSpawnMs{0}; // steady clock; 0 = never spawned
+    mutable std::mutex errorMtx;
+    std::string error;
+
+    int connectServer();
+    AdbStatus sendRequest(int fd, const std::string& request);
+    AdbStatus readStatus(int fd);
+    AdbStatus readLengthPrefixed(int fd, std::string& out);
+    AdbStatus hostQuery(const std::string& request, std::string* reply);
+    AdbStatus fail(AdbStatus status, const std::string& message);
+
+public:
+    // ANDROID_ADB_SERVER_PORT, like the adb CLI, or 5037
+    static int defaultPort();
+
+    explicit AdbClient(std::string serverHost = "127.0.0.1", int serverPort = defaultPort());
+
+    // Per send/recv on sockets opened from now on, streams included (their
+    // owners poll before reading, so this only bounds stalled transfers)
+    void setIoTimeout(int timeoutMs) { ioTimeoutMs = timeoutMs; }
+
+    // host services
+    AdbStatus startServer(); // host:version, spawning the server if it is down
+    AdbStatus connectDevice(const std::string& serial);
+    AdbStatus disconnectDevice(const std::string& serial);
+    AdbStatus getState(const std::string& serial, std::string& state);
+
+    // Switches a fresh server connection to the device transport and opens
+    // `service` (e.g. "shell:ls", "exec:sh") on it. On success fd is the raw stream.
+    AdbStatus openService(const std::string& serial, const std::string& service, int& fd);
+
+    // One-shot helpers: run a command and collect its output until EOF
+    AdbStatus shell(const std::string& serial, const std::string& command, std::string* output = nullptr);
+    AdbStatus exec(const std::string& serial, const std::string& command, std::string* output = nullptr);
+
+    // Uploads a local file through the sync: service (what `adb push` does)
+    AdbStatus push(const std::string& serial, const std::string& localPath,
+                   const std::string& remotePath, int mode = 0755);
+
+    std::string lastError() const;
+};
+
+const char* toString(AdbStatus status);
+
+#endif
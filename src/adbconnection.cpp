@@ -0,0 +1,200 @@
+#include "adbconnection.h"
+#include "cancel.h"
+#include "traceevents.h"
+#include "log.h"
+
+#include <algorithm>
+
+namespace {
+    const int kKeepaliveMs = 2000;
+    // Reconnect backoff while the link is down
+    const int kRetryInitialMs = 250;
+    const int kRetryMaxMs = 5000;
+    // waitUntilUp() checks for cancellation this often
+    const int kCancelCheckMs = 100;
+
+    long long msSince(AdbConnection::Clock::time_point since) {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(AdbConnection::Clock::now() - since).count();
+    }
+}
+
+AdbConnection::AdbConnection(std::function<void()> lost, std::function<void()> restored)
+    : onLost(std::move(lost)), onRestored(std::move(restored)) {
+    thread = std::thread([this] { loop(); });
+}
+
+AdbConnection::~AdbConnection() {
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        quitting = true;
+    }
+    cv.notify_one();
+    upCv.notify_all();
+    if (thread.joinable()) thread.join();
+}
+
+bool AdbConnection::transportUp(const std::string& target) {
+    std::lock_guard<std::mutex> lock(clientMtx);
+    std::string state;
+    return client.getState(target, state) == AdbStatus::Ok && state == "device";
+}
+
+bool AdbConnection::reconnect(const std::string& target) {
+    {
+        std::lock_guard<std::mutex> lock(clientMtx);
+        if (client.connectDevice(target) != AdbStatus::Ok) return false;
+    }
+    return transportUp(target);
+}
+
+/// @brief adb connect to `deviceSerial`; the transport must reach "device" state
+bool AdbConnection::connect(const std::string& deviceSerial) {
+    {
+        // Any earlier link is replaced, not reconnected
+        std::lock_guard<std::mutex> lock(mtx);
+        wanted = false;
+        serial = deviceSerial;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(clientMtx);
+        AdbStatus status = client.connectDevice(deviceSerial);
+        if (status != AdbStatus::Ok) {
+            Log::error() << "adb connect " << deviceSerial << " failed: " << toString(status)
+                         << " (" << client.lastError() << ")";
+            return false;
+        }
+    }
+    if (!transportUp(deviceSerial)) return false;
+
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (serial != deviceSerial) return false;
+        wanted = true;
+        probeNow = false;
+        up = true;
+    }
+    upCv.notify_all();
+    cv.notify_one();
+    return true;
+}
+
+void AdbConnection::disconnect() {
+    std::string target;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (wanted && !up) downtimeMs += msSince(downSince);
+        wanted = false;
+        up = false;
+        target = serial;
+    }
+    upCv.notify_all();
+    cv.notify_one();
+    if (target.empty()) return;
+
+    std::lock_guard<std::mutex> lock(clientMtx);
+    AdbStatus status = client.disconnectDevice(target);
+    if (status != AdbStatus::Ok) {
+        Log::error() << "adb disconnect " << target << " failed: " << toString(status)
+                     << " (" << client.lastError() << ")";
+    }
+}
+
+void AdbConnection::setPaused(bool pause) {
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        paused = pause;
+        if (!pause) probeNow = true;
+    }
+    cv.notify_one();
+}
+
+bool AdbConnection::isWanted() const {
+    std::lock_guard<std::mutex> lock(mtx);
+    return wanted;
+}
+
+bool AdbConnection::waitUntilUp(int timeoutMs) {
+    auto deadline = Clock::now() + std::chrono::milliseconds(timeoutMs);
+    std::unique_lock<std::mutex> lock(mtx);
+    while (!up) {
+        if (!wanted || quitting || Cancel::requested() || Clock::now() >= deadline) return false;
+        upCv.wait_for(lock, std::chrono::milliseconds(kCancelCheckMs));
+    }
+    return true;
+}
+
+AdbConnection::Stats AdbConnection::stats() const {
+    std::lock_guard<std::mutex> lock(mtx);
+    Stats s;
+    s.reconnects = reconnects;
+    s.downtimeMs = downtimeMs + (wanted && !up ? msSince(downSince) : 0);
+    s.up = up;
+    return s;
+}
+
+void AdbConnection::markDown() {
+    up = false;
+    downSince = Clock::now();
+    Log::info() << "adb link to " << serial << " lost, reconnecting";
+    TraceEvents::instant("state", "adb link lost", {{"serial", serial}});
+}
+
+void AdbConnection::markUp() {
+    long long outage = msSince(downSince);
+    downtimeMs += outage;
+    ++reconnects;
+    up = true;
+    upCv.notify_all();
+    Log::info() << "adb link back after " << outage << " ms (reconnect #" << reconnects
+                << ", " << downtimeMs << " ms down in total)";
+    TraceEvents::instant("state", "adb link back", {{"serial", serial}, {"outage ms", std::to_string(outage)}});
+}
+
+/// @brief Keepalive: probes the transport while the link is wanted, and
+/// reconnects with exponential backoff while it is down
+void AdbConnection::loop() {
+    TraceEvents::nameThread("adb keepalive");
+    std::unique_lock<std::mutex> lock(mtx);
+    int retryMs = kRetryInitialMs;
+    while (!quitting) {
+        if (!wanted || paused) {
+            cv.wait(lock, [this] { return quitting || (wanted && !paused); });
+            continue;
+        }
+
+        cv.wait_for(lock, std::chrono::milliseconds(up ? kKeepaliveMs : retryMs), [this] {
+            return quitting || probeNow || !wanted || paused;
+        });
+        probeNow = false;
+        if (quitting || !wanted || paused) continue;
+
+        const std::string target = serial;
+        const bool wasUp = up;
+        lock.unlock();
+        bool ok = transportUp(target) || (!wasUp && reconnect(target));
+        lock.lock();
+        // connect()/disconnect() ran meanwhile: their state wins
+        if (!wanted || serial != target || up != wasUp) continue;
+
+        if (ok && !wasUp) {
+            markUp();
+            retryMs = kRetryInitialMs;
+            if (onRestored) {
+                lock.unlock();
+                onRestored();
+                lock.lock();
+            }
+        } else if (!ok && wasUp) {
+            markDown();
+            retryMs = kRetryInitialMs;
+            if (onLost) {
+                lock.unlock();
+                onLost();
+                lock.lock();
+            }
+        } else if (!ok) {
+            retryMs = std::min(retryMs * 2, kRetryMaxMs);
+        }
+    }
+}
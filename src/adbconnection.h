@@ -0,0 +1,80 @@
+// adb link to the container, kept alive in the background.
+// Once connected, a keepalive thread asks the adb server for the transport
+// state every 2 s (a local socket round trip). When the transport drops, for
+// example because adbd restarted in the container, it reconnects with
+// backoff. Callers that need the link can wait for it instead of failing.
+// Streams opened over the old transport do not survive a reconnect; the
+// `restored` callback is the place to reopen them.
+#ifndef ADBCONNECTION_H
+#define ADBCONNECTION_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "adbclient.h"
+
+class AdbConnection {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    struct Stats {
+        unsigned long reconnects = 0; // outages recovered from
+        long long downtimeMs = 0;     // total, including the current outage
+        bool up = false;
+    };
+
+private:
+    AdbClient client;     // separate from Waydroid's, so probes never race its requests
+    std::mutex clientMtx; // one request on `client` at a time
+    std::function<void()> onLost;
+    std::function<void()> onRestored;
+
+    mutable std::mutex mtx; // state below; never held across an adb request
+    std::condition_variable cv;          // wakes the keepalive thread
+    std::condition_variable upCv;        // wakes waitUntilUp()
+    std::string serial;
+    bool wanted = false;                 // connected on purpose; reconnect if it drops
+    bool paused = false;                 // container frozen: expect no answers
+    bool probeNow = false;
+    bool quitting = false;
+    Clock::time_point downSince;
+    unsigned long reconnects = 0;
+    long long downtimeMs = 0;
+    std::atomic<bool> up{false};
+    std::thread thread;
+
+    void loop();
+    bool transportUp(const std::string& target);
+    bool reconnect(const std::string& target);
+    void markDown();
+    void markUp();
+
+public:
+    // `lost` runs on the keepalive thread each time the link drops, and
+    // `restored` each time it comes back (not after connect())
+    explicit AdbConnection(std::function<void()> lost = nullptr, std::function<void()> restored = nullptr);
+    ~AdbConnection();
+
+    AdbConnection(const AdbConnection&) = delete;
+    AdbConnection& operator=(const AdbConnection&) = delete;
+
+    // adb connect; on success the link is kept up until disconnect()
+    bool connect(const std::string& deviceSerial);
+    void disconnect();
+    // Stops probing while the container is frozen; unpausing probes at once
+    void setPaused(bool pause);
+
+    bool isUp() const { return up; }
+    bool isWanted() const;
+    // Waits for a dropped link to come back. Returns true if it is up,
+    // false on timeout, cancellation or when nobody wants the link.
+    bool waitUntilUp(int timeoutMs);
+    Stats stats() const;
+};
+
+#endif
@@ -0,0 +1,174 @@
+#include "adbshell.h"
+#include "traceevents.h"
+#include "log.h"
+
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+
+namespace {
+    const char* const kMarker = "__WAYPI_DONE_";
+    const size_t kTraceNameMax = 80;
+
+    using Clock = std::chrono::steady_clock;
+
+    int remainingMs(Clock::time_point deadline) {
+        auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - Clock::now()).count();
+        return left > 0 ? static_cast<int>(left) : 0;
+    }
+
+    // First line of a (possibly multi-line) script, shortened for trace names
+    std::string traceName(const std::string& command) {
+        std::string name = command.substr(0, command.find('\n'));
+        if (name.size() > kTraceNameMax) name = name.substr(0, kTraceNameMax) + "...";
+        return name;
+    }
+}
+
+AdbShell::~AdbShell() {
+    close();
+}
+
+/// @brief Opens (or reopens) a persistent shell on the given adb device
+/// @return true if the session stream was opened
+bool AdbShell::open(const std::string& deviceSerial) {
+    std::lock_guard<std::mutex> lock(mtx);
+    closeLocked();
+    serial = deviceSerial;
+    return spawn();
+}
+
+void AdbShell::close() {
+    std::lock_guard<std::mutex> lock(mtx);
+    closeLocked();
+    serial.clear();
+}
+
+bool AdbShell::isOpen() {
+    std::lock_guard<std::mutex> lock(mtx);
+    return fd >= 0;
+}
+
+std::string AdbShell::getSerial() {
+    std::lock_guard<std::mutex> lock(mtx);
+    return serial;
+}
+
+bool AdbShell::spawn() {
+    if (serial.empty()) return false;
+
+    // exec: gives a raw, pty-less stream, so the remote sh reads commands from
+    // our writes and nothing is echoed back
+    AdbStatus status = client.openService(serial, "exec:sh", fd);
+    if (status != AdbStatus::Ok) {
+        Log::error() << "ADB shell session on " << serial << " failed: "
+                     << toString(status) << " (" << client.lastError() << ")";
+        return false;
+    }
+    readBuffer.clear();
+
+    // Fold stderr into the marker-delimited stdout stream
+    if (!writeAll("exec 2>&1\n")) {
+        closeLocked();
+        return false;
+    }
+    Log::info() << "ADB shell session opened on " << serial;
+    return true;
+}
+
+void AdbShell::closeLocked() {
+    if (fd >= 0) {
+        ::close(fd); // closing the stream ends the remote shell
+        fd = -1;
+    }
+    readBuffer.clear();
+}
+
+bool AdbShell::writeAll(const std::string& data, bool* anySent) {
+    size_t off = 0;
+    while (off < data.size()) {
+        ssize_t n = send(fd, data.data() + off, data.size() - off, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        if (anySent && n > 0) *anySent = true;
+        off += static_cast<size_t>(n);
+    }
+    return true;
+}
+
+bool AdbShell::readLine(std::string& line, Clock::time_point deadline) {
+    while (true) {
+        size_t nl = readBuffer.find('\n');
+        if (nl != std::string::npos) {
+            line = readBuffer.substr(0, nl);
+            readBuffer.erase(0, nl + 1);
+            if (!line.empty() && line.back() == '\r') line.pop_back();
+            return true;
+        }
+
+        int timeoutMs = remainingMs(deadline);
+        if (timeoutMs == 0) return false; // past the deadline, even with data waiting
+        struct pollfd pfd{fd, POLLIN, 0};
+        int pr = poll(&pfd, 1, timeoutMs);
+        if (pr < 0 && errno == EINTR) continue;
+        if (pr <= 0) return false; // error or timeout
+
+        char buf[4096];
+        ssize_t n = recv(fd, buf, sizeof(buf), 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false; // transport closed
+        readBuffer.append(buf, static_cast<size_t>(n));
+    }
+}
+
+int AdbShell::runLocked(const std::string& command, std::string* output, int timeoutMs, bool& sent) {
+    sent = false;
+    if (fd < 0 && !spawn()) return -1;
+
+    std::string marker = kMarker + std::to_string(++sequence) + "__";
+    if (!writeAll(command + "\necho " + marker + " $?\n", &sent)) return -1;
+
+    // One deadline for the whole command, so steady output cannot keep it alive
+    const auto deadline = Clock::now() + std::chrono::milliseconds(timeoutMs);
+    std::string line;
+    while (readLine(line, deadline)) {
+        size_t pos = line.find(marker);
+        if (pos != std::string::npos) {
+            // Output not ending in a newline shares the marker's line
+            if (output && pos > 0) *output += line.substr(0, pos);
+            return std::atoi(line.c_str() + pos + marker.size());
+        }
+        if (output) *output += line + "\n";
+    }
+    return -1;
+}
+
+int AdbShell::run(const std::string& command, std::string* output, int timeoutMs) {
+    std::lock_guard<std::mutex> lock(mtx);
+    TraceEvents::Span span("adb", TraceEvents::enabled() ? traceName(command) : std::string());
+    span.arg("command", command);
+
+    bool sent = false;
+    int status = runLocked(command, output, timeoutMs, sent);
+    if (status == -1 && !sent && !serial.empty()) {
+        // Nothing reached the device: reopen and retry once
+        Log::warn() << "ADB shell session lost, reopening";
+        closeLocked();
+        if (output) output->clear();
+        status = runLocked(command, output, timeoutMs, sent);
+    }
+    if (status == -1 && sent) {
+        // Timed out or dropped mid-command. It may have run, so it is not
+        // repeated; the next command starts a fresh session, away from
+        // this one's late output
+        Log::warn() << "ADB shell command got no completion marker, closing the session";
+        closeLocked();
+    }
+    span.arg("exit", status);
+    return status;
+}
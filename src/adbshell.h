@@ -0,0 +1,49 @@
+// Long-lived device shell session used for all device-side commands
+#ifndef ADBSHELL_H
+#define ADBSHELL_H
+
+#include <string>
+#include <mutex>
+#include <chrono>
+
+#include "adbclient.h"
+
+class AdbShell {
+private:
+    AdbClient& client;
+    std::string serial;
+    int fd = -1; // `exec:sh` stream on the device transport
+    unsigned long sequence = 0;
+    std::string readBuffer;
+    std::mutex mtx;
+
+    bool spawn();
+    void closeLocked();
+    bool writeAll(const std::string& data, bool* anySent = nullptr);
+    bool readLine(std::string& line, std::chrono::steady_clock::time_point deadline);
+    int runLocked(const std::string& command, std::string* output, int timeoutMs, bool& sent);
+
+public:
+    explicit AdbShell(AdbClient& adbClient) : client(adbClient) {}
+    ~AdbShell();
+
+    AdbShell(const AdbShell&) = delete;
+    AdbShell& operator=(const AdbShell&) = delete;
+
+    bool open(const std::string& deviceSerial);
+    void close();
+    bool isOpen();
+    // A copy, taken under the lock: open() and close() may swap it meanwhile
+    std::string getSerial();
+    // For services beside the session, e.g. a second exec: stream
+    AdbClient& getClient() { return client; }
+
+    // Runs a command in the session and waits for its completion marker.
+    // Returns the command's exit status, or -1 if the session failed. Only a
+    // command that never reached the device is retried on a new session; once
+    // any of it was sent (it may have run, e.g. injected keys), a failure
+    // closes the session and returns -1.
+    int run(const std::string& command, std::string* output = nullptr, int timeoutMs = 30000);
+};
+
+#endif
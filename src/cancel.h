@@ -0,0 +1,47 @@
+// Cooperative cancellation for long-running navigation.
+// The command worker binds a token to its thread with Cancel::Scope; waits and
+// key senders check Cancel::requested() at step boundaries and stop early.
+#ifndef CANCEL_H
+#define CANCEL_H
+
+#include <atomic>
+#include <memory>
+
+namespace Cancel {
+    class Token {
+    private:
+        std::shared_ptr<std::atomic<bool>> flag;
+
+    public:
+        // A default token can never be cancelled
+        Token() = default;
+        static Token create() {
+            Token token;
+            token.flag = std::make_shared<std::atomic<bool>>(false);
+            return token;
+        }
+
+        void cancel() const { if (flag) *flag = true; }
+        bool cancelled() const { return flag && *flag; }
+    };
+
+    inline thread_local Token current;
+
+    // Binds a token to the calling thread for the lifetime of the scope
+    class Scope {
+    private:
+        Token saved;
+
+    public:
+        explicit Scope(const Token& token) : saved(current) { current = token; }
+        ~Scope() { current = saved; }
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+    };
+
+    inline bool requested() {
+        return current.cancelled();
+    }
+}
+
+#endif
@@ -0,0 +1,158 @@
+#include "channelinput.h"
+#include "log.h"
+
+#include <map>
+
+namespace {
+    // Quiet time after the last +/- before the net offset is tuned. Longer than
+    // the gap between quick taps, shorter than a deliberate pause.
+    const int kStepSettleMs = 400;
+    // Time allowed between digits of one channel number
+    const int kDigitTimeoutMs = 1500;
+    // Shorter wait when the digits so far already name a channel (1 of 10):
+    // enough for a second key typed straight after, without stalling the
+    // single-digit zap by the full timeout
+    const int kCompleteDigitTimeoutMs = 700;
+    const size_t kMaxDigits = 4;
+
+    const std::map<int, Channels> channelMap = {
+        {1, Channels::SVT1},
+        {2, Channels::SVT2},
+        {3, Channels::KUNSKAPSKANALEN},
+        {4, Channels::SVT24},
+        {5, Channels::EON_BN_MUZIKA},
+        {6, Channels::EON_BN},
+        {7, Channels::EON_HAPPY},
+        {8, Channels::EON_PRVA},
+        {9, Channels::EON_PINK},
+        {0, Channels::EON_RTS_1},
+        {10, Channels::EON_NATURE}
+    };
+
+    // True if a mapped number longer than `prefix` starts with it
+    bool canExtend(const std::string& prefix) {
+        for (const auto& pair : channelMap) {
+            std::string number = std::to_string(pair.first);
+            if (number.size() > prefix.size() && number.compare(0, prefix.size(), prefix) == 0) return true;
+        }
+        return false;
+    }
+}
+
+ChannelInput::ChannelInput(Controller& ctl, EventLoop& eventLoop) : controller(ctl), loop(eventLoop) {
+    stepTimer = loop.addTimer([this] { commitSteps(); });
+    digitTimer = loop.addTimer([this] { commitDigits(); });
+}
+
+ChannelInput::~ChannelInput() {
+    if (stepTimer >= 0) loop.remove(stepTimer);
+    if (digitTimer >= 0) loop.remove(digitTimer);
+}
+
+std::optional<Channels> ChannelInput::channelFor(int number) {
+    auto it = channelMap.find(number);
+    if (it == channelMap.end()) return std::nullopt;
+    return it->second;
+}
+
+int ChannelInput::numberOf(Channels ch) {
+    for (const auto& pair : channelMap) {
+        if (pair.second == ch) return pair.first;
+    }
+    return -1;
+}
+
+bool ChannelInput::select(int number, Clock::time_point pressedAt) {
+    auto ch = channelFor(number);
+    if (!ch) return false;
+
+    // A direct choice overrides any +/- still settling
+    pendingSteps = 0;
+    if (stepTimer >= 0) loop.disarmTimer(stepTimer);
+
+    Log::info() << "Changing to channel " << number;
+    controller.requestChannel(*ch, pressedAt);
+    return true;
+}
+
+void ChannelInput::digit(int d, Clock::time_point pressedAt) {
+    if (digits.size() >= kMaxDigits) digits.clear();
+    if (digits.empty()) digitsAt = pressedAt;
+    digits += static_cast<char>('0' + d);
+
+    if (!canExtend(digits) || digitTimer < 0) {
+        commitDigits();
+        return;
+    }
+    Log::info() << "Channel: " << digits << "_";
+    bool complete = channelMap.count(std::stoi(digits)) > 0;
+    loop.armTimer(digitTimer, complete ? kCompleteDigitTimeoutMs : kDigitTimeoutMs);
+}
+
+bool ChannelInput::enter() {
+    if (digits.empty()) return false;
+    commitDigits();
+    return true;
+}
+
+void ChannelInput::commitDigits() {
+    if (digits.empty()) return;
+    if (digitTimer >= 0) loop.disarmTimer(digitTimer);
+
+    int number = std::stoi(digits);
+    digits.clear();
+    if (!select(number, digitsAt)) {
+        Log::info() << "No channel mapped to " << number;
+    }
+}
+
+void ChannelInput::step(int delta, Clock::time_point pressedAt) {
+    // Stepping abandons a half-typed number
+    digits.clear();
+    if (digitTimer >= 0) loop.disarmTimer(digitTimer);
+
+    if (!controller.isStarting() && !controller.isRunning()) {
+        Log::info() << "Cannot change channels - Waydroid is not running!";
+        return;
+    }
+
+    if (pendingSteps == 0) {
+        stepFrom = numberOf(controller.targetChannel());
+        stepsAt = pressedAt;
+    }
+    pendingSteps += delta;
+    Log::info() << (delta > 0 ? "Channel up: " : "Channel down: ") << "channel "
+                << numberAfter(stepFrom, pendingSteps);
+
+    if (stepTimer >= 0) {
+        loop.armTimer(stepTimer, kStepSettleMs);
+    } else {
+        commitSteps(); // no timer: tune every step
+    }
+}
+
+void ChannelInput::commitSteps() {
+    if (pendingSteps == 0) return;
+
+    int number = numberAfter(stepFrom, pendingSteps);
+    Log::info() << "Channel " << (pendingSteps > 0 ? "+" : "") << pendingSteps
+                << ": changing to channel " << number;
+    pendingSteps = 0;
+    controller.requestChannel(channelMap.at(number), stepsAt);
+}
+
+/// @brief Channel number `steps` positions after `from` in map order, wrapping around
+/// An unmapped `from` starts at the first channel going up and the last going down
+int ChannelInput::numberAfter(int from, int steps) const {
+    const int count = static_cast<int>(channelMap.size());
+    int index = 0;
+    auto it = channelMap.find(from);
+    if (it == channelMap.end()) {
+        index = steps > 0 ? -1 : count;
+    } else {
+        index = static_cast<int>(std::distance(channelMap.begin(), it));
+    }
+
+    index = ((index + steps) % count + count) % count;
+    return std::next(channelMap.begin(), index)->first;
+}
@@ -0,0 +1,60 @@
+// Channel selection from key input, shared by the keypad and terminal handlers.
+// Digits are collected into a channel number and tuned on Enter, after an
+// inter-digit timeout (shorter once the digits already name a channel), or as
+// soon as no longer number can follow.
+// +/- presses (taps or a held key's repeats) are coalesced into one net offset
+// and tuned once the keys go quiet, so intermediate channels are never zapped.
+#ifndef CHANNELINPUT_H
+#define CHANNELINPUT_H
+
+#include <chrono>
+#include <optional>
+#include <string>
+
+#include "channels.h"
+#include "controller.h"
+#include "eventloop.h"
+
+class ChannelInput {
+public:
+    using Clock = std::chrono::steady_clock;
+
+private:
+    Controller& controller;
+    EventLoop& loop;
+
+    int stepTimer = -1;
+    int pendingSteps = 0;
+    int stepFrom = -1; // channel number the pending steps count from
+    Clock::time_point stepsAt; // first press of the pending steps
+
+    int digitTimer = -1;
+    std::string digits; // number typed so far
+    Clock::time_point digitsAt; // first digit, where the zap's latency starts
+
+    void commitSteps();
+    void commitDigits();
+    int numberAfter(int from, int steps) const;
+
+public:
+    ChannelInput(Controller& ctl, EventLoop& eventLoop);
+    ~ChannelInput();
+
+    ChannelInput(const ChannelInput&) = delete;
+    ChannelInput& operator=(const ChannelInput&) = delete;
+
+    // Tunes the channel mapped to `number`; false if nothing is mapped to it
+    // `pressedAt` is when the user started asking for it
+    bool select(int number, Clock::time_point pressedAt = Clock::now());
+    // Adds a typed digit (0-9) to the channel number being entered
+    void digit(int d, Clock::time_point pressedAt = Clock::now());
+    // Tunes the number being entered now; false if no digits are pending
+    bool enter();
+    // Moves `delta` channels up (+) or down (-), tuned after kStepSettleMs of quiet
+    void step(int delta, Clock::time_point pressedAt = Clock::now());
+
+    static std::optional<Channels> channelFor(int number);
+    static int numberOf(Channels ch); // -1 if the channel has no number
+};
+
+#endif
@@ -19,6 +19,13 @@ enum class Channels {
 namespace ChannelUtil {
     enum class AppId { SVT, EON, Unknown };
 
+    // Every channel, in declaration order
+    inline constexpr Channels all[] = {
+        Channels::SVT1, Channels::SVT2, Channels::KUNSKAPSKANALEN, Channels::SVT24,
+        Channels::EON_RTS_1, Channels::EON_PINK, Channels::EON_PRVA, Channels::EON_HAPPY,
+        Channels::EON_BN, Channels::EON_BN_MUZIKA, Channels::EON_NATURE
+    };
+
     inline constexpr bool isSVT(Channels ch) {
         switch (ch) {
             case Channels::SVT1:
@@ -46,9 +53,34 @@ namespace ChannelUtil {
         }
     }
 
+    inline constexpr const char* name(Channels ch) {
+        switch (ch) {
+            case Channels::SVT1: return "SVT1";
+            case Channels::SVT2: return "SVT2";
+            case Channels::KUNSKAPSKANALEN: return "Kunskapskanalen";
+            case Channels::SVT24: return "SVT24";
+            case Channels::EON_RTS_1: return "RTS 1";
+            case Channels::EON_PINK: return "Pink";
+            case Channels::EON_PRVA: return "Prva";
+            case Channels::EON_HAPPY: return "Happy";
+            case Channels::EON_BN: return "BN";
+            case Channels::EON_BN_MUZIKA: return "BN Muzika";
+            case Channels::EON_NATURE: return "Nature";
+            default: return "Unknown";
+        }
+    }
+
     inline constexpr AppId appFor(Channels ch) {
         return isSVT(ch) ? AppId::SVT : (isEON(ch) ? AppId::EON : AppId::Unknown);
     }
+
+    inline constexpr const char* appName(AppId app) {
+        switch (app) {
+            case AppId::SVT: return "SVT";
+            case AppId::EON: return "EON";
+            default: return "Unknown";
+        }
+    }
 }
 
 #endif
@@ -0,0 +1,313 @@
+#include "controller.h"
+#include "traceevents.h"
+#include "log.h"
+
+#include <algorithm>
+#include <chrono>
+
+namespace {
+    // How long a command waits for a dropped adb link to come back
+    const int kAdbHoldMs = 15000;
+}
+
+Controller::Controller(Waydroid& w) : waydroid(w), target(w.getChannel()) {
+    worker = std::thread([this] { loop(); });
+}
+
+Controller::~Controller() {
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        queue.clear();
+        queue.push_back(Command{CommandType::Quit});
+        inFlight.cancel();
+    }
+    cv.notify_one();
+    if (worker.joinable()) worker.join();
+
+    if (predictions > 0) {
+        Log::info() << "Predictions: " << hits << "/" << predictions << " correct, " << prewarmedHits
+                    << " of them prewarmed (" << prewarms << " prewarms, " << prewarmsCancelled
+                    << " cancelled), ~" << savedMs << " ms saved by prewarming";
+    }
+}
+
+void Controller::enqueue(const Command& command) {
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        queue.push_back(command);
+    }
+    cv.notify_one();
+}
+
+void Controller::requestStart() {
+    if (waydroid.isStarting()) {
+        Log::info() << "Waydroid is already starting!";
+        return;
+    }
+    if (waydroid.isStandby()) {
+        Log::info() << "Resuming from standby...";
+        enqueue(Command{CommandType::Resume});
+        return;
+    }
+    if (cancelPrewarm("Enter")) return;
+    if (isRunning()) {
+        Log::info() << "Waydroid is already running!";
+        return;
+    }
+
+    Log::info() << "Starting Waydroid...";
+    // Set before returning so channel keys pressed right after are deferred
+    waydroid.markStarting();
+    enqueue(Command{CommandType::Start});
+}
+
+void Controller::requestStop() {
+    if (waydroid.isStarting()) {
+        Log::info() << "Waydroid is still starting!";
+        return;
+    }
+    // The session alone decides: a failed adb connect must not make it unstoppable
+    if (!waydroid.isRunning()) {
+        Log::info() << "Waydroid is not running!";
+        return;
+    }
+
+    Log::info() << "Stopping Waydroid...";
+    {
+        // Nothing queued before the stop is worth doing any more
+        std::lock_guard<std::mutex> lock(mtx);
+        queue.clear();
+        queue.push_back(Command{CommandType::Stop});
+        if (inFlightPreemptible) inFlight.cancel();
+    }
+    cv.notify_one();
+}
+
+void Controller::requestStandby() {
+    if (waydroid.isStarting()) {
+        Log::info() << "Waydroid is still starting!";
+        return;
+    }
+    if (!waydroid.isRunning()) {
+        Log::info() << "Waydroid is not running!";
+        return;
+    }
+    if (waydroid.isStandby()) {
+        Log::info() << "Already in standby";
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (inFlightPrewarm) {
+            Log::info() << "Already entering standby";
+            return;
+        }
+        Log::info() << "Entering standby...";
+        queue.clear();
+        queue.push_back(Command{CommandType::Standby});
+        if (inFlightPreemptible) inFlight.cancel();
+    }
+    cv.notify_one();
+}
+
+void Controller::requestChannel(Channels ch, ZapTrace::Clock::time_point pressedAt) {
+    target = ch;
+    if (waydroid.deferChannel(ch)) return;
+
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        queue.erase(std::remove_if(queue.begin(), queue.end(), [](const Command& c) {
+            return c.type == CommandType::SetChannel;
+        }), queue.end());
+        Command command{CommandType::SetChannel, ch};
+        command.pressedAt = pressedAt;
+        command.queuedAt = ZapTrace::Clock::now();
+        queue.push_back(command);
+        if (inFlightPreemptible && !inFlight.cancelled()) {
+            Log::info() << "Preempting work in progress";
+            inFlight.cancel();
+        }
+    }
+    cv.notify_one();
+}
+
+void Controller::requestKey(Key key) {
+    if (waydroid.isStarting()) {
+        Log::info() << "Waydroid is starting; ignoring " << KeyUtil::androidName(key);
+        return;
+    }
+    if (waydroid.isStandby()) {
+        Log::info() << "In standby (Enter resumes); ignoring " << KeyUtil::androidName(key);
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        queue.push_back(Command{CommandType::Key, Channels::SVT1, key});
+    }
+    // A key means someone is watching after all
+    cancelPrewarm(KeyUtil::androidName(key));
+    cv.notify_one();
+}
+
+/// @brief Cancels the prewarm of a standby in progress, and so the standby
+/// @return true if there was one to cancel
+bool Controller::cancelPrewarm(const char* why) {
+    std::lock_guard<std::mutex> lock(mtx);
+    if (!inFlightPrewarm || inFlight.cancelled()) return false;
+    Log::info() << "Cancelling standby for " << why;
+    inFlight.cancel();
+    return true;
+}
+
+void Controller::loop() {
+    TraceEvents::nameThread("controller");
+    while (true) {
+        Command command;
+        Cancel::Token token = Cancel::Token::create();
+        {
+            std::unique_lock<std::mutex> lock(mtx);
+            cv.wait(lock, [this] { return !queue.empty(); });
+            command = queue.front();
+            queue.pop_front();
+            if (command.type == CommandType::Quit) return;
+            inFlight = token;
+            // Keys are preemptible too, so a key held for adb never delays a stop
+            inFlightPreemptible = command.type == CommandType::SetChannel || command.type == CommandType::Key;
+        }
+
+        {
+            Cancel::Scope scope(token);
+            execute(command);
+        }
+
+        std::lock_guard<std::mutex> lock(mtx);
+        inFlight = Cancel::Token();
+        inFlightPreemptible = false;
+        inFlightPrewarm = false;
+    }
+}
+
+void Controller::execute(const Command& command) {
+    switch (command.type) {
+        case CommandType::Start:
+            waydroid.start();
+            break;
+        case CommandType::Stop:
+            waydroid.stop();
+            break;
+        case CommandType::Standby:
+            // Nobody is watching now, so the predicted app can take the screen
+            // while it starts
+            if (prediction && waydroid.isConnectedAdb()) {
+                {
+                    std::lock_guard<std::mutex> lock(mtx);
+                    inFlightPreemptible = true;
+                    inFlightPrewarm = true;
+                }
+                long long ms = waydroid.prewarm(*prediction);
+                {
+                    std::lock_guard<std::mutex> lock(mtx);
+                    inFlightPreemptible = false;
+                    inFlightPrewarm = false;
+                }
+                if (ms >= 0) {
+                    ++prewarms;
+                    prewarmedMs = ms;
+                }
+                if (Cancel::requested()) {
+                    ++prewarmsCancelled;
+                    Log::info() << "Standby cancelled";
+                    break;
+                }
+            }
+            // Without a freezable container, fall back to a full stop
+            if (!waydroid.standby()) {
+                Log::info() << "Standby failed, stopping Waydroid instead";
+                waydroid.stop();
+            }
+            break;
+        case CommandType::Resume:
+            waydroid.resume();
+            break;
+        case CommandType::SetChannel: {
+            ZapTrace trace(command.pressedAt);
+            trace.add("input", command.queuedAt - command.pressedAt);
+            trace.add("queue", ZapTrace::Clock::now() - command.queuedAt);
+            ZapTrace::Scope traced(trace);
+            TraceEvents::Span span("zap", std::string("to ") + ChannelUtil::name(command.channel));
+
+            // A channel key wakes the box up and tunes in one go
+            auto begin = ZapTrace::Clock::now();
+            if (waydroid.isStandby() && !waydroid.resume()) break;
+            if (!waydroid.isRunning() || !adbReady(ChannelUtil::name(command.channel))) {
+                Log::info() << "Cannot change channels - Waydroid is not running!";
+                break;
+            }
+            ZapTrace::note("resume", begin);
+
+            Channels from = waydroid.getChannel();
+            waydroid.setChannel(command.channel);
+            if (Cancel::requested()) {
+                Log::info() << "Channel change to " << ChannelUtil::name(command.channel)
+                            << " cancelled by a newer request";
+            } else if (waydroid.getChannel() == command.channel) {
+                AdbConnection::Stats adb = waydroid.adbStats();
+                metrics.setAdbStats(adb.reconnects, adb.downtimeMs);
+                metrics.record(from, command.channel, trace);
+                learn(from, command.channel);
+            }
+            break;
+        }
+        case CommandType::Key:
+            if (adbReady(KeyUtil::androidName(command.key))) waydroid.keys().press(command.key);
+            break;
+        case CommandType::Quit:
+            break;
+    }
+}
+
+/// @brief True if adb is usable, waiting up to kAdbHoldMs while a dropped link
+/// is reconnected. If it does not come back, queued keys are dropped as well.
+bool Controller::adbReady(const char* what) {
+    if (waydroid.isConnectedAdb()) return true;
+    if (!waydroid.hasAdbLink()) return false;
+
+    Log::info() << "adb link down; holding " << what << " until it is back";
+    if (waydroid.waitForAdb(kAdbHoldMs)) return true;
+    if (Cancel::requested()) return false;
+
+    Log::info() << "adb link still down; dropping " << what << " and queued keys";
+    std::lock_guard<std::mutex> lock(mtx);
+    queue.erase(std::remove_if(queue.begin(), queue.end(), [](const Command& c) {
+        return c.type == CommandType::Key;
+    }), queue.end());
+    return false;
+}
+
+/// @brief Scores the last prediction against the zap that happened, records the
+/// zap and predicts the next one
+void Controller::learn(Channels from, Channels to) {
+    if (from == to) return;
+
+    if (prediction) {
+        ++predictions;
+        bool hit = *prediction == to;
+        if (hit) ++hits;
+        // Saved: the cold start paid before standby minus the warm resume paid now
+        if (hit && prewarmedMs > 0 && waydroid.lastAppSwitch() == Waydroid::AppSwitch::Resumed) {
+            ++prewarmedHits;
+            savedMs += prewarmedMs - waydroid.lastAppSwitchMs();
+        }
+        // Most hits need no prewarm: the app is usually resident already
+        Log::info() << "Prediction " << (hit ? "hit" : "miss") << " (" << hits << "/" << predictions
+                    << " correct, " << prewarmedHits << " prewarmed, ~" << savedMs << " ms saved)";
+    }
+
+    history.record(from, to);
+    prediction = history.predict(to);
+    prewarmedMs = -1;
+    if (prediction) {
+        Log::info() << "Predicted next channel: " << ChannelUtil::name(*prediction);
+    }
+}
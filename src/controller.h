@@ -0,0 +1,107 @@
+// Single owner of the Waydroid instance.
+// Input handlers only enqueue commands; one worker thread executes them in
+// order. A new channel request replaces any queued one and cancels the zap in
+// flight at its next step boundary (latest wins), so input never blocks.
+// After each zap the worker predicts the next channel from the zap history.
+// Starting an app takes the screen, so the predicted channel's app is only
+// prewarmed on the way into standby, when nobody is watching, and only if it
+// is not resident yet. After the wake-up, switching to it is a warm resume.
+// Any input during that prewarm cancels it and the standby with it.
+// Each completed zap is timed from the key press to the channel being live.
+#ifndef CONTROLLER_H
+#define CONTROLLER_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <thread>
+
+#include "cancel.h"
+#include "channels.h"
+#include "keys.h"
+#include "waydroid.h"
+#include "zaphistory.h"
+#include "zapmetrics.h"
+
+class Controller {
+private:
+    enum class CommandType {
+        Start,
+        Stop,
+        Standby,
+        Resume,
+        SetChannel,
+        Key,
+        Quit
+    };
+
+    struct Command {
+        CommandType type;
+        Channels channel = Channels::SVT1;
+        Key key = Key::DPAD_CENTER;
+        ZapTrace::Clock::time_point pressedAt{}; // SetChannel: first key of the request
+        ZapTrace::Clock::time_point queuedAt{};
+    };
+
+    Waydroid& waydroid;
+
+    std::deque<Command> queue;
+    std::mutex mtx;
+    std::condition_variable cv;
+    // Token of the command being executed; only channel changes, keys and a
+    // standby's prewarm are preempted
+    Cancel::Token inFlight;
+    bool inFlightPreemptible = false;
+    bool inFlightPrewarm = false; // any input preempts it
+
+    // Prediction state, only touched by the worker
+    ZapHistory history;
+    std::optional<Channels> prediction;
+    long long prewarmedMs = -1;    // cold start paid before standby for `prediction`
+    unsigned long predictions = 0;
+    unsigned long hits = 0;
+    unsigned long prewarmedHits = 0; // hits whose app had been prewarmed
+    unsigned long prewarms = 0;
+    unsigned long prewarmsCancelled = 0;
+    long long savedMs = 0;
+    ZapMetrics metrics;
+
+    std::atomic<Channels> target;
+
+    std::thread worker;
+
+    void loop();
+    void execute(const Command& command);
+    void enqueue(const Command& command);
+    void learn(Channels from, Channels to);
+    bool adbReady(const char* what);
+    bool cancelPrewarm(const char* why);
+
+public:
+    explicit Controller(Waydroid& w);
+    ~Controller();
+
+    Controller(const Controller&) = delete;
+    Controller& operator=(const Controller&) = delete;
+
+    // Starts Waydroid, or resumes it from standby
+    void requestStart();
+    void requestStop();
+    void requestStandby();
+    void requestChannel(Channels ch, ZapTrace::Clock::time_point pressedAt = ZapTrace::Clock::now());
+    void requestKey(Key key);
+
+    bool isStarting() const { return waydroid.isStarting(); }
+    // Read from the status monitor's snapshot, so a crashed container shows up
+    // here without a command having run. A dropped adb link is still running:
+    // commands are held until it is back.
+    bool isRunning() const { return waydroid.isRunning() && waydroid.hasAdbLink(); }
+    bool isStandby() const { return waydroid.isStandby(); }
+    // Latest requested channel, used by +/- so quick presses accumulate
+    Channels targetChannel() const { return target; }
+};
+
+#endif
@@ -0,0 +1,40 @@
+#include "deviceprobe.h"
+
+std::string DeviceProbe::bootCompleted() {
+    return "[ \"$(getprop sys.boot_completed)\" = 1 ]";
+}
+
+std::string DeviceProbe::packageManagerReady() {
+    return "pm path android >/dev/null 2>&1";
+}
+
+std::string DeviceProbe::focusIs(const std::string& component) {
+    return "dumpsys window | grep mCurrentFocus= | grep -q '" + component + "'";
+}
+
+std::string DeviceProbe::transitionIdle() {
+    return "dumpsys window | grep -q 'mAppTransitionState=APP_STATE_IDLE'";
+}
+
+std::string DeviceProbe::settledOn(const std::string& component) {
+    return "{ " + focusIs(component) + " && " + transitionIdle() + "; }";
+}
+
+std::string DeviceProbe::processAlive(const std::string& package) {
+    return "pidof " + package + " >/dev/null";
+}
+
+std::string DeviceProbe::screenState() {
+    // Only identities, not the view hierarchy: its layout and flags keep
+    // changing while video plays, which would end every wait at once
+    return "{ dumpsys window | grep -E 'mCurrentFocus=|mFocusedApp='; "
+           "dumpsys activity top | grep -E '^ *ACTIVITY |^ *#[0-9]+: [A-Za-z0-9_.$]+\\{'; } 2>/dev/null | md5sum";
+}
+
+std::string DeviceProbe::screenChangedFrom(const std::string& baseline) {
+    return "[ \"$(" + screenState() + ")\" != " + baseline + " ]";
+}
+
+bool DeviceProbe::check(AdbShell& adb, const std::string& condition) {
+    return adb.run(condition, nullptr, 5000) == 0;
+}
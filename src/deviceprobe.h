@@ -0,0 +1,35 @@
+// Cheap Android readiness signals, as device-side shell conditions.
+// Each condition exits 0 when the state is reached, so it can be polled from
+// the host with check() or embedded in a KeySequence wait.
+#ifndef DEVICEPROBE_H
+#define DEVICEPROBE_H
+
+#include <string>
+
+#include "adbshell.h"
+
+namespace DeviceProbe {
+    // sys.boot_completed is set once the framework has finished booting
+    std::string bootCompleted();
+    // The package manager answers, so apps can be launched (before boot completes)
+    std::string packageManagerReady();
+    // The focused window (mCurrentFocus) belongs to `component` (package or package/activity)
+    std::string focusIs(const std::string& component);
+    // No activity transition is animating
+    std::string transitionIdle();
+    // `component` is focused and its window has finished appearing
+    std::string settledOn(const std::string& component);
+    // `package` has a live process (its task can be resumed warm)
+    std::string processAlive(const std::string& package);
+
+    // Prints a hash of what is on screen: the focused window, the top
+    // activity and its fragment stack. Stable during playback; in-app
+    // navigation that swaps fragments within one activity still changes it.
+    std::string screenState();
+    // The screen differs from `baseline`, a shell word holding an earlier screenState()
+    std::string screenChangedFrom(const std::string& baseline);
+
+    bool check(AdbShell& adb, const std::string& condition);
+}
+
+#endif
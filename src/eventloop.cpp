@@ -0,0 +1,113 @@
+#include "eventloop.h"
+#include "log.h"
+
+#include <cerrno>
+#include <cstring>
+#include <signal.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+namespace {
+    const int kMaxEvents = 16;
+}
+
+EventLoop::EventLoop() {
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd < 0) Log::error() << "epoll_create1: " << std::strerror(errno);
+}
+
+EventLoop::~EventLoop() {
+    for (int fd : owned) close(fd);
+    if (epfd >= 0) close(epfd);
+}
+
+bool EventLoop::add(int fd, Handler handler, uint32_t events) {
+    epoll_event ev{};
+    ev.events = events;
+    ev.data.fd = fd;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        Log::error() << "epoll_ctl(ADD): " << std::strerror(errno);
+        return false;
+    }
+    handlers[fd] = std::make_shared<Handler>(std::move(handler));
+    return true;
+}
+
+void EventLoop::remove(int fd) {
+    if (handlers.erase(fd) == 0) return;
+    epoll_ctl(epfd, EPOLL_CTL_DEL, fd, nullptr);
+    if (owned.erase(fd)) close(fd);
+}
+
+int EventLoop::addTimer(std::function<void()> onExpire) {
+    int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (fd < 0) {
+        Log::error() << "timerfd_create: " << std::strerror(errno);
+        return -1;
+    }
+    bool added = add(fd, [fd, onExpire](uint32_t) {
+        uint64_t expirations;
+        // A timer re-armed after it fired but before we got here reads EAGAIN: not expired
+        if (read(fd, &expirations, sizeof(expirations)) != sizeof(expirations)) return;
+        onExpire();
+    });
+    if (!added) {
+        close(fd);
+        return -1;
+    }
+    owned.insert(fd);
+    return fd;
+}
+
+void EventLoop::armTimer(int timer, int ms) {
+    itimerspec spec{};
+    spec.it_value.tv_sec = ms / 1000;
+    spec.it_value.tv_nsec = static_cast<long>(ms % 1000) * 1000000L;
+    if (timerfd_settime(timer, 0, &spec, nullptr) < 0) Log::error() << "timerfd_settime: " << std::strerror(errno);
+}
+
+bool EventLoop::watchSignals(std::initializer_list<int> signals, std::function<void(int)> onSignal) {
+    sigset_t mask;
+    sigemptyset(&mask);
+    for (int sig : signals) sigaddset(&mask, sig);
+    if (pthread_sigmask(SIG_BLOCK, &mask, nullptr) != 0) return false;
+
+    int fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (fd < 0) {
+        Log::error() << "signalfd: " << std::strerror(errno);
+        return false;
+    }
+    bool added = add(fd, [fd, onSignal](uint32_t) {
+        signalfd_siginfo info;
+        while (read(fd, &info, sizeof(info)) == sizeof(info)) {
+            onSignal(static_cast<int>(info.ssi_signo));
+        }
+    });
+    if (!added) {
+        close(fd);
+        return false;
+    }
+    owned.insert(fd);
+    return true;
+}
+
+void EventLoop::run() {
+    running = true;
+    epoll_event events[kMaxEvents];
+    while (running && !handlers.empty()) {
+        int n = epoll_wait(epfd, events, kMaxEvents, -1);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            Log::error() << "epoll_wait: " << std::strerror(errno);
+            break;
+        }
+        for (int i = 0; i < n && running; ++i) {
+            // Look the handler up per event: an earlier handler may have removed this fd
+            auto it = handlers.find(events[i].data.fd);
+            if (it == handlers.end()) continue;
+            std::shared_ptr<Handler> handler = it->second;
+            (*handler)(events[i].events);
+        }
+    }
+}
@@ -0,0 +1,53 @@
+// Single-threaded epoll reactor for all input sources.
+// File descriptors (evdev devices, stdin), timers (timerfd) and termination
+// signals (signalfd) are dispatched from one epoll_wait, with no polling timeouts.
+#ifndef EVENTLOOP_H
+#define EVENTLOOP_H
+
+#include <cstdint>
+#include <functional>
+#include <initializer_list>
+#include <map>
+#include <memory>
+#include <set>
+#include <sys/epoll.h>
+
+class EventLoop {
+public:
+    using Handler = std::function<void(uint32_t events)>;
+
+private:
+    int epfd = -1;
+    bool running = false;
+    std::map<int, std::shared_ptr<Handler>> handlers;
+    std::set<int> owned; // timerfds and the signalfd, closed on remove()
+
+public:
+    EventLoop();
+    ~EventLoop();
+
+    EventLoop(const EventLoop&) = delete;
+    EventLoop& operator=(const EventLoop&) = delete;
+
+    // Watches `fd` (level-triggered); the caller keeps ownership of the fd
+    bool add(int fd, Handler handler, uint32_t events = EPOLLIN);
+    // Stops watching `fd`; safe to call from inside its own handler
+    void remove(int fd);
+    bool contains(int fd) const { return handlers.count(fd) != 0; }
+
+    // One-shot timer; returns its id (a timerfd) or -1. Starts disarmed.
+    int addTimer(std::function<void()> onExpire);
+    // (Re)arms the timer to fire once after `ms`; 0 disarms it
+    void armTimer(int timer, int ms);
+    void disarmTimer(int timer) { armTimer(timer, 0); }
+
+    // Blocks the signals in the calling thread and delivers them through a signalfd.
+    // Call before starting other threads so they inherit the blocked mask.
+    bool watchSignals(std::initializer_list<int> signals, std::function<void(int)> onSignal);
+
+    // Dispatches events until stop() is called
+    void run();
+    void stop() { running = false; }
+};
+
+#endif
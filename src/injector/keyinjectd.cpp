@@ -0,0 +1,171 @@
+// Resident key injector running inside the Waydroid container.
+// Creates a uinput keyboard once and injects key batches received on an
+// abstract unix socket (reached through adbd), so a key press costs a socket
+// write instead of an `input` JVM start. Only root and the adb shell user may
+// connect; apps in the container are refused.
+#include "protocol.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <linux/uinput.h>
+
+namespace {
+    const int kKeys[] = {
+        KEY_UP, KEY_DOWN, KEY_LEFT, KEY_RIGHT, KEY_SELECT, KEY_BACK, KEY_HOMEPAGE,
+        KEY_PAGEUP, KEY_PAGEDOWN, KEY_HOME, KEY_END, KEY_ENTER,
+        KEY_0, KEY_1, KEY_2, KEY_3, KEY_4, KEY_5, KEY_6, KEY_7, KEY_8, KEY_9
+    };
+
+    bool readFully(int fd, void* buf, size_t len) {
+        char* p = static_cast<char*>(buf);
+        while (len > 0) {
+            ssize_t n = read(fd, p, len);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return false;
+            p += n;
+            len -= static_cast<size_t>(n);
+        }
+        return true;
+    }
+
+    bool isSupported(int code) {
+        for (int key : kKeys) if (key == code) return true;
+        return false;
+    }
+
+    void emit(int fd, int type, int code, int value) {
+        struct input_event ev{};
+        ev.type = static_cast<uint16_t>(type);
+        ev.code = static_cast<uint16_t>(code);
+        ev.value = value;
+        if (write(fd, &ev, sizeof(ev)) != sizeof(ev)) perror("uinput write");
+    }
+
+    void sleepMs(int ms) {
+        struct timespec ts{ms / 1000, (ms % 1000) * 1000000L};
+        while (nanosleep(&ts, &ts) == -1 && errno == EINTR) {}
+    }
+
+    int createKeyboard() {
+        int fd = open("/dev/uinput", O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+        if (fd < 0) {
+            perror("open /dev/uinput");
+            return -1;
+        }
+        ioctl(fd, UI_SET_EVBIT, EV_KEY);
+        ioctl(fd, UI_SET_EVBIT, EV_SYN);
+        for (int key : kKeys) ioctl(fd, UI_SET_KEYBIT, key);
+
+        struct uinput_setup setup{};
+        setup.id.bustype = BUS_VIRTUAL;
+        setup.id.vendor = 0x5750; // "WP"
+        setup.id.product = 0x0001;
+        std::snprintf(setup.name, UINPUT_MAX_NAME_SIZE, "waypi-keyinjectd");
+        if (ioctl(fd, UI_DEV_SETUP, &setup) < 0 || ioctl(fd, UI_DEV_CREATE) < 0) {
+            perror("uinput setup");
+            close(fd);
+            return -1;
+        }
+        return fd;
+    }
+
+    // SO_PEERCRED of an accepted connection: adbd (shell) or root only
+    bool peerAllowed(int client) {
+        struct ucred cred{};
+        socklen_t length = sizeof(cred);
+        if (getsockopt(client, SOL_SOCKET, SO_PEERCRED, &cred, &length) != 0) return false;
+        return cred.uid == InjectorProtocol::kRootUid || cred.uid == InjectorProtocol::kShellUid;
+    }
+
+    // Serves one controller connection until it closes
+    void serve(int client, int uinput) {
+        uint8_t header[4];
+        while (readFully(client, header, sizeof(header))) {
+            uint8_t status = InjectorProtocol::kStatusOk;
+            uint16_t count = static_cast<uint16_t>((header[2] << 8) | header[3]);
+            if (header[0] != InjectorProtocol::kMagic0 || header[1] != InjectorProtocol::kMagic1 ||
+                count > InjectorProtocol::kMaxKeys) {
+                return; // out of sync, drop the connection
+            }
+
+            for (uint16_t i = 0; i < count; ++i) {
+                uint8_t raw[4];
+                if (!readFully(client, raw, sizeof(raw))) return;
+                int code = (raw[0] << 8) | raw[1];
+                int delayMs = (raw[2] << 8) | raw[3];
+                if (!isSupported(code)) {
+                    status = InjectorProtocol::kStatusError;
+                    continue;
+                }
+                emit(uinput, EV_KEY, code, 1);
+                emit(uinput, EV_SYN, SYN_REPORT, 0);
+                emit(uinput, EV_KEY, code, 0);
+                emit(uinput, EV_SYN, SYN_REPORT, 0);
+                if (delayMs > 0) sleepMs(delayMs);
+            }
+            if (write(client, &status, 1) != 1) return;
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    bool daemonize = false;
+    const char* name = InjectorProtocol::kSocketName;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "-d") == 0) daemonize = true;
+        else if (std::strcmp(argv[i], "-s") == 0 && i + 1 < argc) name = argv[++i];
+    }
+
+    int server = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    // Abstract namespace: a leading NUL, no file to clean up
+    const size_t nameLength = std::min(std::strlen(name), sizeof(addr.sun_path) - 1);
+    std::memcpy(addr.sun_path + 1, name, nameLength);
+    socklen_t addrLength = static_cast<socklen_t>(offsetof(sockaddr_un, sun_path) + 1 + nameLength);
+    if (bind(server, reinterpret_cast<sockaddr*>(&addr), addrLength) < 0) {
+        // Another instance already owns the name: nothing to do
+        if (errno == EADDRINUSE) return 0;
+        perror("bind");
+        return 1;
+    }
+    listen(server, 1);
+
+    int uinput = createKeyboard();
+    if (uinput < 0) return 1;
+
+    if (daemonize) {
+        if (fork() > 0) _exit(0);
+        setsid();
+        int devnull = open("/dev/null", O_RDWR);
+        dup2(devnull, STDIN_FILENO);
+        dup2(devnull, STDOUT_FILENO);
+        dup2(devnull, STDERR_FILENO);
+        if (devnull > STDERR_FILENO) close(devnull);
+    }
+
+    while (true) {
+        int client = accept4(server, nullptr, nullptr, SOCK_CLOEXEC);
+        if (client < 0) {
+            if (errno == EINTR) continue;
+            perror("accept");
+            break;
+        }
+        if (peerAllowed(client)) serve(client, uinput);
+        close(client);
+    }
+
+    ioctl(uinput, UI_DEV_DESTROY);
+    close(uinput);
+    return 0;
+}
@@ -0,0 +1,32 @@
+// Wire format between the controller and the on-device key injector
+#ifndef INJECTOR_PROTOCOL_H
+#define INJECTOR_PROTOCOL_H
+
+#include <cstdint>
+
+namespace InjectorProtocol {
+    // Abstract unix socket inside the container. The controller reaches it as
+    // the adb service "localabstract:<name>", so nothing listens on the network.
+    constexpr const char* kSocketName = "waypi-keyinjectd";
+    // Peers allowed to send keys: root and the shell user adbd runs as
+    constexpr unsigned kRootUid = 0;
+    constexpr unsigned kShellUid = 2000;
+    constexpr const char* kDevicePath = "/data/local/tmp/keyinjectd";
+
+    // Request: 'W' 'K' count(u16) followed by count entries, all big-endian.
+    // An empty request is a ping. The injector replies with one status byte
+    // once every key of the request has been injected.
+    constexpr uint8_t kMagic0 = 'W';
+    constexpr uint8_t kMagic1 = 'K';
+    constexpr uint16_t kMaxKeys = 1024;
+
+    struct Entry {
+        uint16_t code;    // Linux input key code
+        uint16_t delayMs; // pause after the key
+    };
+
+    constexpr uint8_t kStatusOk = 0;
+    constexpr uint8_t kStatusError = 1;
+}
+
+#endif
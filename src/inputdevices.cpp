@@ -0,0 +1,187 @@
+#include "inputdevices.h"
+#include "log.h"
+
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/inotify.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace {
+    const char* const kInputDir = "/dev/input";
+    // Events per read(); a key press with its scan code and SYN is 3-4 events
+    const size_t kReadBatch = 64;
+
+    bool isEventNode(const char* name) {
+        return strncmp(name, "event", 5) == 0;
+    }
+
+    bool testBit(const unsigned long* bits, int bit) {
+        const int width = sizeof(unsigned long) * CHAR_BIT;
+        return (bits[bit / width] >> (bit % width)) & 1UL;
+    }
+}
+
+InputDevices::InputDevices(EventLoop& eventLoop, FrameHandler handler)
+    : loop(eventLoop), onFrame(std::move(handler)) {}
+
+InputDevices::~InputDevices() {
+    // Release all
+    for (const auto& device : devices) {
+        loop.remove(device.second.fd);
+        ioctl(device.second.fd, EVIOCGRAB, 0);
+        close(device.second.fd);
+    }
+    if (inotifyFd >= 0) {
+        loop.remove(inotifyFd);
+        close(inotifyFd);
+    }
+}
+
+bool InputDevices::hasKeypadKeys(int fd) {
+    const int width = sizeof(unsigned long) * CHAR_BIT;
+    unsigned long types[(EV_MAX + width) / width] = {};
+    unsigned long keys[(KEY_MAX + width) / width] = {};
+
+    if (ioctl(fd, EVIOCGBIT(0, sizeof(types)), types) < 0 || !testBit(types, EV_KEY)) return false;
+    if (ioctl(fd, EVIOCGBIT(EV_KEY, sizeof(keys)), keys) < 0) return false;
+
+    const int digits[] = {KEY_KP0, KEY_KP1, KEY_KP2, KEY_KP3, KEY_KP4,
+                          KEY_KP5, KEY_KP6, KEY_KP7, KEY_KP8, KEY_KP9};
+    for (int key : digits) {
+        if (!testBit(keys, key)) return false;
+    }
+    return true;
+}
+
+bool InputDevices::start() {
+    // Watch before scanning so a device appearing in between is not missed
+    inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotifyFd < 0) {
+        Log::error() << "inotify_init1: " << std::strerror(errno);
+    } else if (inotify_add_watch(inotifyFd, kInputDir, IN_CREATE | IN_ATTRIB | IN_DELETE) < 0) {
+        Log::error() << "inotify_add_watch " << kInputDir << ": " << std::strerror(errno);
+        close(inotifyFd);
+        inotifyFd = -1;
+    } else {
+        loop.add(inotifyFd, [this](uint32_t) { readHotplug(); });
+    }
+
+    scan();
+    return inotifyFd >= 0 || !devices.empty();
+}
+
+void InputDevices::scan() {
+    DIR* dir = opendir(kInputDir);
+    if (!dir) {
+        Log::error() << "Cannot open " << kInputDir;
+        return;
+    }
+
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != nullptr) {
+        if (isEventNode(entry->d_name)) addDevice(std::string(kInputDir) + "/" + entry->d_name);
+    }
+    closedir(dir);
+}
+
+void InputDevices::addDevice(const std::string& path) {
+    if (devices.count(path)) return;
+
+    int fd = open(path.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0) {
+        // udev may not have set permissions yet; IN_ATTRIB retries once it has
+        if (errno != EACCES) Log::warn() << "Cannot open device: " << path;
+        return;
+    }
+
+    if (!hasKeypadKeys(fd)) {
+        close(fd);
+        return;
+    }
+
+    // Stamp events on the monotonic clock, so press-to-live latency can be measured
+    int clock = CLOCK_MONOTONIC;
+    ioctl(fd, EVIOCSCLOCKID, &clock);
+
+    if (ioctl(fd, EVIOCGRAB, 1) == -1) {
+        Log::error() << "EVIOCGRAB failed for " << path << ": " << std::strerror(errno);
+    } else {
+        Log::info() << "Grabbed: " << path;
+    }
+
+    devices[path] = Device{fd, {}, false};
+    loop.add(fd, [this, path](uint32_t events) { readDevice(path, events); });
+}
+
+std::chrono::steady_clock::time_point InputDevices::timeOf(const input_event& ev) {
+    using Clock = std::chrono::steady_clock;
+    const auto now = Clock::now();
+    const Clock::time_point at(std::chrono::seconds(ev.input_event_sec) + std::chrono::microseconds(ev.input_event_usec));
+    // A device that kept its realtime clock gives a nonsense offset; use arrival time then
+    if (at > now || now - at > std::chrono::seconds(10)) return now;
+    return at;
+}
+
+void InputDevices::removeDevice(const std::string& path) {
+    auto it = devices.find(path);
+    if (it == devices.end()) return;
+
+    loop.remove(it->second.fd);
+    close(it->second.fd);
+    devices.erase(it);
+    Log::info() << "Released: " << path;
+}
+
+void InputDevices::readDevice(const std::string& path, uint32_t events) {
+    Device& device = devices.at(path);
+    input_event batch[kReadBatch];
+    ssize_t n = read(device.fd, batch, sizeof(batch));
+    if (n <= 0) {
+        if ((n < 0 && errno != EAGAIN && errno != EINTR) || (events & (EPOLLERR | EPOLLHUP))) {
+            // Unplugged: the read fails with ENODEV before inotify reports the delete
+            removeDevice(path);
+        }
+        return;
+    }
+
+    // evdev only returns whole events
+    const size_t count = static_cast<size_t>(n) / sizeof(input_event);
+    for (size_t i = 0; i < count; ++i) {
+        const input_event& ev = batch[i];
+        if (ev.type == EV_SYN && ev.code == SYN_DROPPED) {
+            // The kernel buffer overflowed: this frame is incomplete
+            device.frame.clear();
+            device.dropped = true;
+        } else if (ev.type == EV_SYN && ev.code == SYN_REPORT) {
+            if (!device.dropped && !device.frame.empty()) onFrame(device.frame);
+            device.frame.clear();
+            device.dropped = false;
+        } else if (!device.dropped) {
+            device.frame.push_back(ev);
+        }
+    }
+}
+
+void InputDevices::readHotplug() {
+    alignas(inotify_event) char buf[4096];
+    ssize_t n = read(inotifyFd, buf, sizeof(buf));
+    if (n <= 0) return;
+
+    for (char* p = buf; p < buf + n;) {
+        const auto* event = reinterpret_cast<const inotify_event*>(p);
+        p += sizeof(inotify_event) + event->len;
+        if (event->len == 0 || !isEventNode(event->name)) continue;
+
+        std::string path = std::string(kInputDir) + "/" + event->name;
+        if (event->mask & IN_DELETE) {
+            removeDevice(path);
+        } else {
+            addDevice(path);
+        }
+    }
+}
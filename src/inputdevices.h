@@ -0,0 +1,57 @@
+// Keypad devices under /dev/input, tracked at runtime.
+// Devices are grabbed only if EVIOCGBIT reports keypad keys; inotify adds
+// devices that appear later (replug, late enumeration) and drops removed ones.
+// Events are read in batches and delivered one SYN_REPORT frame at a time.
+#ifndef INPUTDEVICES_H
+#define INPUTDEVICES_H
+
+#include <chrono>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+#include <linux/input.h>
+
+#include "eventloop.h"
+
+class InputDevices {
+public:
+    // All events of one frame, without the closing SYN_REPORT
+    using FrameHandler = std::function<void(const std::vector<input_event>& frame)>;
+
+private:
+    struct Device {
+        int fd;
+        std::vector<input_event> frame; // events since the last SYN_REPORT
+        bool dropped = false;           // after SYN_DROPPED, skip to the next SYN_REPORT
+    };
+
+    EventLoop& loop;
+    FrameHandler onFrame;
+    int inotifyFd = -1;
+    std::map<std::string, Device> devices; // path -> grabbed device
+
+    void scan();
+    void addDevice(const std::string& path);
+    void removeDevice(const std::string& path);
+    void readDevice(const std::string& path, uint32_t events);
+    void readHotplug();
+
+public:
+    InputDevices(EventLoop& eventLoop, FrameHandler handler);
+    ~InputDevices();
+
+    InputDevices(const InputDevices&) = delete;
+    InputDevices& operator=(const InputDevices&) = delete;
+
+    // Grabs the keypads present now and starts watching for hotplug
+    bool start();
+    size_t count() const { return devices.size(); }
+
+    // True if the device reports keypad digit keys
+    static bool hasKeypadKeys(int fd);
+    // When the event happened (devices are switched to the monotonic clock)
+    static std::chrono::steady_clock::time_point timeOf(const input_event& ev);
+};
+
+#endif
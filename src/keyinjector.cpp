@@ -0,0 +1,261 @@
+#include "keyinjector.h"
+#include "injector/protocol.h"
+#include "deviceprobe.h"
+#include "cancel.h"
+#include "zapmetrics.h"
+#include "traceevents.h"
+#include "log.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+
+namespace {
+    const int kAckSlackMs = 5000;
+    const int kConnectAttempts = 10;
+    const int kCancelCheckMs = 1000;
+
+    // The injector paces a batch by its delays, so each key is traced at its
+    // scheduled time within the round trip
+    void traceKeys(const std::vector<KeyStep>& batch, TraceEvents::Clock::time_point begin,
+                   TraceEvents::Clock::time_point end) {
+        if (!TraceEvents::enabled()) return;
+        auto at = begin;
+        for (const auto& step : batch) {
+            auto until = std::min(at + std::chrono::milliseconds(step.delayMs), end);
+            TraceEvents::complete("key", KeyUtil::androidName(step.key), at, until,
+                                  {{"code", std::to_string(KeyUtil::linuxCode(step.key))}});
+            at = until;
+        }
+    }
+
+    // The helper is built next to the controller binary (see Makefile)
+    std::string localHelperPath() {
+        char exe[PATH_MAX];
+        ssize_t n = readlink("/proc/self/exe", exe, sizeof(exe) - 1);
+        if (n <= 0) return "keyinjectd";
+        std::string path(exe, static_cast<size_t>(n));
+        return path.substr(0, path.rfind('/') + 1) + "keyinjectd";
+    }
+}
+
+KeyInjector::~KeyInjector() {
+    disconnect();
+}
+
+bool KeyInjector::connectLocked() {
+    closeLocked();
+
+    if (!client || serial.empty()) return false;
+
+    // adbd connects to the helper's socket inside the container for us
+    int fd = -1;
+    if (client->openService(serial, std::string("localabstract:") + InjectorProtocol::kSocketName, fd) !=
+        AdbStatus::Ok) {
+        return false;
+    }
+    sock = fd;
+
+    // Ping: an empty batch must be acknowledged
+    if (!sendBatchLocked({}, kAckSlackMs)) {
+        closeLocked();
+        return false;
+    }
+    return true;
+}
+
+void KeyInjector::closeLocked() {
+    if (sock >= 0) {
+        close(sock);
+        sock = -1;
+    }
+}
+
+/// @brief Pushes and starts the injector helper inside the container
+/// @return true if the helper is resident and answering
+bool KeyInjector::deploy(AdbClient& adbClient, const std::string& deviceSerial) {
+    std::lock_guard<std::mutex> lock(mtx);
+    client = &adbClient;
+    serial = deviceSerial;
+    return deployLocked();
+}
+
+bool KeyInjector::restore() {
+    std::lock_guard<std::mutex> lock(mtx);
+    if (!client || serial.empty()) return false;
+    Log::info() << "adb link restored; reconnecting the key injector";
+    return deployLocked();
+}
+
+bool KeyInjector::deployLocked() {
+    if (connectLocked()) {
+        Log::info() << "Key injector already resident on " << serial;
+        return true;
+    }
+
+    std::string local = localHelperPath();
+    if (access(local.c_str(), R_OK) != 0) {
+        Log::warn() << "Key injector helper " << local << " not built; using adb input";
+        return false;
+    }
+    // Helpers from older builds listened on TCP on every interface; stop them
+    // (and free the binary for the push)
+    adb.run("su 0 pkill -x keyinjectd 2>/dev/null; pkill -x keyinjectd 2>/dev/null; true");
+
+    AdbStatus status = client->push(serial, local, InjectorProtocol::kDevicePath);
+    if (status != AdbStatus::Ok) {
+        Log::warn() << "Key injector push failed: " << toString(status)
+                    << " (" << client->lastError() << "); using adb input";
+        return false;
+    }
+
+    // uinput needs root; try su first, then run as the shell user
+    std::string path = InjectorProtocol::kDevicePath;
+    adb.run("su 0 " + path + " -d || " + path + " -d");
+
+    for (int attempt = 0; attempt < kConnectAttempts; ++attempt) {
+        if (connectLocked()) {
+            Log::info() << "Key injector started on " << serial;
+            return true;
+        }
+        TraceEvents::Span pause("sleep", "key injector start");
+        usleep(100000);
+    }
+    Log::warn() << "Key injector did not come up; using adb input";
+    return false;
+}
+
+void KeyInjector::disconnect() {
+    std::lock_guard<std::mutex> lock(mtx);
+    closeLocked();
+    client = nullptr;
+    serial.clear();
+}
+
+bool KeyInjector::isResident() {
+    std::lock_guard<std::mutex> lock(mtx);
+    return sock >= 0;
+}
+
+bool KeyInjector::sendBatchLocked(const std::vector<KeyStep>& batch, int timeoutMs) {
+    std::vector<uint8_t> frame;
+    frame.reserve(4 + batch.size() * 4);
+    frame.push_back(InjectorProtocol::kMagic0);
+    frame.push_back(InjectorProtocol::kMagic1);
+    frame.push_back(static_cast<uint8_t>(batch.size() >> 8));
+    frame.push_back(static_cast<uint8_t>(batch.size()));
+    for (const auto& step : batch) {
+        int code = KeyUtil::linuxCode(step.key);
+        int delay = std::min(step.delayMs, 0xFFFF);
+        frame.push_back(static_cast<uint8_t>(code >> 8));
+        frame.push_back(static_cast<uint8_t>(code));
+        frame.push_back(static_cast<uint8_t>(delay >> 8));
+        frame.push_back(static_cast<uint8_t>(delay));
+    }
+
+    size_t off = 0;
+    while (off < frame.size()) {
+        ssize_t n = ::send(sock, frame.data() + off, frame.size() - off, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        off += static_cast<size_t>(n);
+    }
+
+    struct pollfd pfd{sock, POLLIN, 0};
+    if (poll(&pfd, 1, timeoutMs) <= 0) return false;
+    uint8_t status = InjectorProtocol::kStatusError;
+    if (recv(sock, &status, 1, 0) != 1) return false;
+    return status == InjectorProtocol::kStatusOk;
+}
+
+/// @brief Injects a sequence, one socket round trip per run of keys between waits
+/// Long runs are split so a cancelled request stops within about kCancelCheckMs
+/// @return 0 on success, KeySequence::kCancelled if cancelled, non-zero if any part failed
+int KeyInjector::send(const KeySequence& sequence, const std::string& label) {
+    std::unique_lock<std::mutex> lock(mtx);
+    if (sock < 0) {
+        lock.unlock();
+        return sequence.send(adb, label);
+    }
+
+    TraceEvents::Span span("keys", label);
+    span.arg("path", "injector");
+    const auto pieces = sequence.chunks(kCancelCheckMs, InjectorProtocol::kMaxKeys);
+    unsigned long trips = 0;
+    size_t sent = 0;
+    int status = 0;
+    for (size_t i = 0; i < pieces.size(); ++i) {
+        if (Cancel::requested()) {
+            status = KeySequence::kCancelled;
+            break;
+        }
+
+        const auto& batch = pieces[i].getSteps();
+        const KeyStep& last = batch.back();
+        size_t done = 0; // keys of this batch the injector acknowledged
+        auto deliver = [&](size_t end) {
+            std::vector<KeyStep> keys(batch.begin() + static_cast<long>(done), batch.begin() + static_cast<long>(end));
+            if (keys.empty()) return true;
+            int keysMs = 0;
+            for (const auto& step : keys) keysMs += step.delayMs;
+            ++trips;
+            auto begin = ZapTrace::Clock::now();
+            bool delivered = sendBatchLocked(keys, keysMs + kAckSlackMs);
+            ZapTrace::note("keys", begin);
+            traceKeys(keys, begin, ZapTrace::Clock::now());
+            if (!delivered) return false;
+            done = end;
+            sent += keys.size();
+            ZapTrace::countKeys(keys.size());
+            return true;
+        };
+
+        // A change wait compares with the screen right before its key, so
+        // that key goes in its own round trip after the baseline is taken
+        std::string baseline;
+        bool delivered = deliver(last.waitForChange ? batch.size() - 1 : batch.size());
+        if (delivered && done < batch.size()) {
+            ++trips;
+            lock.unlock();
+            adb.run(DeviceProbe::screenState(), &baseline);
+            lock.lock();
+            while (!baseline.empty() && baseline.back() == '\n') baseline.pop_back();
+            // A disconnect() meanwhile leaves sock at -1: the fallback below sends the key
+            delivered = deliver(batch.size());
+        }
+        if (!delivered) {
+            Log::warn() << label << ": key injector lost, falling back to adb input";
+            closeLocked();
+            lock.unlock();
+            KeySequence rest;
+            for (size_t j = done; j < batch.size(); ++j) rest.append(batch[j]);
+            for (size_t j = i + 1; j < pieces.size(); ++j) rest.append(pieces[j]);
+            return rest.send(adb, label);
+        }
+
+        if (!last.waitFor.empty()) {
+            ++trips;
+            TraceEvents::Span waitSpan("wait", last.waitFor);
+            auto begin = ZapTrace::Clock::now();
+            lock.unlock();
+            status = adb.run(KeySequence::waitScript(last, "'" + baseline + "'"), nullptr,
+                             last.waitTimeoutMs + kAckSlackMs);
+            lock.lock();
+            ZapTrace::note("wait", begin);
+            // The wait script itself ends at its deadline with 0, so this is the shell failing
+            if (status != 0) break;
+        }
+    }
+
+    Log::info() << label << ": " << sent << (sent == 1 ? " key in " : " keys in ")
+                << trips << (trips == 1 ? " round trip" : " round trips") << " (injector"
+                << (status == KeySequence::kCancelled ? ", cancelled)" : status == 0 ? ")" : ", failed)");
+    return status;
+}
+
+int KeyInjector::press(Key key) {
+    return send(KeySequence().press(key), KeyUtil::androidName(key));
+}
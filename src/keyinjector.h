@@ -0,0 +1,53 @@
+// Client for the resident on-device key injector (src/injector/keyinjectd.cpp).
+// The helper listens on an abstract unix socket in the container; the client
+// reaches it through adbd's localabstract: service, never over the network.
+// Falls back to `input keyevent` over the adb shell when the helper is not available.
+#ifndef KEYINJECTOR_H
+#define KEYINJECTOR_H
+
+#include <string>
+#include <mutex>
+
+#include "keys.h"
+#include "keysequence.h"
+#include "adbclient.h"
+#include "adbshell.h"
+
+class KeyInjector {
+private:
+    AdbShell& adb;
+    AdbClient* client = nullptr; // set by deploy()
+    std::string serial;
+    int sock = -1;
+    std::mutex mtx;
+
+    bool connectLocked();
+    void closeLocked();
+    bool deployLocked();
+    bool sendBatchLocked(const std::vector<KeyStep>& batch, int timeoutMs);
+
+public:
+    explicit KeyInjector(AdbShell& shell) : adb(shell) {}
+    ~KeyInjector();
+
+    KeyInjector(const KeyInjector&) = delete;
+    KeyInjector& operator=(const KeyInjector&) = delete;
+
+    // Pushes and starts the helper unless it already answers on the device
+    bool deploy(AdbClient& adbClient, const std::string& deviceSerial);
+    // After an adb reconnect: the old stream is dead, so reconnects to the
+    // helper, redeploying it if the container lost it. No-op unless deployed.
+    bool restore();
+    // Closes the stream; restore() does nothing until the next deploy()
+    void disconnect();
+    bool isResident();
+
+    // The lock is released while a wait or screen probe runs on the adb
+    // shell, so deploy(), restore() and disconnect() never stall behind a
+    // slow screen. Keys of another send() can land in that gap; the
+    // controller sends from one worker thread, so in practice they do not.
+    int send(const KeySequence& sequence, const std::string& label);
+    int press(Key key);
+};
+
+#endif
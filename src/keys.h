@@ -0,0 +1,97 @@
+#ifndef KEYS_H
+#define KEYS_H
+
+#include <linux/input-event-codes.h>
+
+// Remote-control keys the controller injects into Android
+enum class Key {
+    DPAD_UP,
+    DPAD_DOWN,
+    DPAD_LEFT,
+    DPAD_RIGHT,
+    DPAD_CENTER,
+    BACK,
+    HOME,
+    PAGE_UP,
+    PAGE_DOWN,
+    MOVE_HOME,
+    MOVE_END,
+    ENTER,
+    NUM_0,
+    NUM_1,
+    NUM_2,
+    NUM_3,
+    NUM_4,
+    NUM_5,
+    NUM_6,
+    NUM_7,
+    NUM_8,
+    NUM_9
+};
+
+namespace KeyUtil {
+    // Android KeyEvent name, as accepted by `input keyevent`
+    inline constexpr const char* androidName(Key key) {
+        switch (key) {
+            case Key::DPAD_UP: return "KEYCODE_DPAD_UP";
+            case Key::DPAD_DOWN: return "KEYCODE_DPAD_DOWN";
+            case Key::DPAD_LEFT: return "KEYCODE_DPAD_LEFT";
+            case Key::DPAD_RIGHT: return "KEYCODE_DPAD_RIGHT";
+            case Key::DPAD_CENTER: return "KEYCODE_DPAD_CENTER";
+            case Key::BACK: return "KEYCODE_BACK";
+            case Key::HOME: return "KEYCODE_HOME";
+            case Key::PAGE_UP: return "KEYCODE_PAGE_UP";
+            case Key::PAGE_DOWN: return "KEYCODE_PAGE_DOWN";
+            case Key::MOVE_HOME: return "KEYCODE_MOVE_HOME";
+            case Key::MOVE_END: return "KEYCODE_MOVE_END";
+            case Key::ENTER: return "KEYCODE_ENTER";
+            case Key::NUM_0: return "KEYCODE_0";
+            case Key::NUM_1: return "KEYCODE_1";
+            case Key::NUM_2: return "KEYCODE_2";
+            case Key::NUM_3: return "KEYCODE_3";
+            case Key::NUM_4: return "KEYCODE_4";
+            case Key::NUM_5: return "KEYCODE_5";
+            case Key::NUM_6: return "KEYCODE_6";
+            case Key::NUM_7: return "KEYCODE_7";
+            case Key::NUM_8: return "KEYCODE_8";
+            case Key::NUM_9: return "KEYCODE_9";
+            default: return "KEYCODE_UNKNOWN";
+        }
+    }
+
+    // Linux input code that Android's Generic.kl maps to the same key,
+    // used by the on-device injector's uinput keyboard
+    inline constexpr int linuxCode(Key key) {
+        switch (key) {
+            case Key::DPAD_UP: return KEY_UP;
+            case Key::DPAD_DOWN: return KEY_DOWN;
+            case Key::DPAD_LEFT: return KEY_LEFT;
+            case Key::DPAD_RIGHT: return KEY_RIGHT;
+            case Key::DPAD_CENTER: return KEY_SELECT;
+            case Key::BACK: return KEY_BACK;
+            case Key::HOME: return KEY_HOMEPAGE;
+            case Key::PAGE_UP: return KEY_PAGEUP;
+            case Key::PAGE_DOWN: return KEY_PAGEDOWN;
+            case Key::MOVE_HOME: return KEY_HOME;
+            case Key::MOVE_END: return KEY_END;
+            case Key::ENTER: return KEY_ENTER;
+            case Key::NUM_0: return KEY_0;
+            case Key::NUM_1: return KEY_1;
+            case Key::NUM_2: return KEY_2;
+            case Key::NUM_3: return KEY_3;
+            case Key::NUM_4: return KEY_4;
+            case Key::NUM_5: return KEY_5;
+            case Key::NUM_6: return KEY_6;
+            case Key::NUM_7: return KEY_7;
+            case Key::NUM_8: return KEY_8;
+            case Key::NUM_9: return KEY_9;
+            default: return KEY_RESERVED;
+        }
+    }
+
+    inline constexpr Key digit(int d) {
+        return static_cast<Key>(static_cast<int>(Key::NUM_0) + d);
+    }
+}
+
+#endif
@@ -0,0 +1,152 @@
+#include "keysequence.h"
+#include "deviceprobe.h"
+#include "cancel.h"
+#include "zapmetrics.h"
+#include "traceevents.h"
+#include "log.h"
+
+#include <sstream>
+
+namespace {
+    const int kWaitPollMs = 200;
+    const int kRoundTripSlackMs = 10000;
+    // Longest stretch of delays sent without checking for cancellation
+    const int kCancelCheckMs = 1000;
+
+    std::string seconds(int ms) {
+        std::ostringstream oss;
+        oss << ms / 1000 << "." << (ms % 1000) / 100 << (ms % 100) / 10 << ms % 10;
+        return oss.str();
+    }
+}
+
+KeySequence& KeySequence::press(Key key, int delayMs) {
+    steps.push_back(KeyStep{key, delayMs, "", 0});
+    return *this;
+}
+
+KeySequence& KeySequence::repeat(Key key, int count, int delayMs) {
+    for (int i = 0; i < count; ++i) press(key, delayMs);
+    return *this;
+}
+
+KeySequence& KeySequence::waitUntil(const std::string& condition, int timeoutMs) {
+    if (!steps.empty()) {
+        steps.back().waitFor = condition;
+        steps.back().waitTimeoutMs = timeoutMs;
+    }
+    return *this;
+}
+
+KeySequence& KeySequence::waitUntilChanged(const std::string& condition, int timeoutMs) {
+    waitUntil(condition, timeoutMs);
+    if (!steps.empty()) steps.back().waitForChange = true;
+    return *this;
+}
+
+KeySequence& KeySequence::append(const KeySequence& other) {
+    steps.insert(steps.end(), other.steps.begin(), other.steps.end());
+    return *this;
+}
+
+KeySequence& KeySequence::append(const KeyStep& step) {
+    steps.push_back(step);
+    return *this;
+}
+
+std::string KeySequence::toScript() const {
+    std::ostringstream script;
+    std::string batch; // keys waiting to be injected together
+
+    auto flush = [&]() {
+        if (batch.empty()) return;
+        script << "input keyevent" << batch << "\n";
+        batch.clear();
+    };
+
+    for (const auto& step : steps) {
+        if (step.waitForChange) {
+            // The baseline is taken right before this key, after the ones ahead of it
+            flush();
+            script << "waypi_screen=$(" << DeviceProbe::screenState() << ")\n";
+        }
+        batch += " ";
+        batch += KeyUtil::androidName(step.key);
+        if (step.delayMs == 0 && step.waitFor.empty()) continue;
+
+        flush();
+        if (step.delayMs > 0) script << "sleep " << seconds(step.delayMs) << "\n";
+        if (!step.waitFor.empty()) script << waitScript(step, "\"$waypi_screen\"") << "\n";
+    }
+    flush();
+    return script.str();
+}
+
+std::string KeySequence::waitScript(const std::string& condition, int timeoutMs) {
+    // Deadline in centiseconds of /proc/uptime, so slow polls (a dumpsys can
+    // take longer than the poll interval) do not stretch the timeout
+    std::ostringstream script;
+    script << "read t _ </proc/uptime; d=$((${t%.*}${t#*.} + " << (timeoutMs + 9) / 10 << "));"
+           << " until " << condition << "; do"
+           << " read t _ </proc/uptime; [ \"${t%.*}${t#*.}\" -ge $d ] && break;"
+           << " sleep " << seconds(kWaitPollMs) << "; done";
+    return script.str();
+}
+
+std::string KeySequence::waitScript(const KeyStep& step, const std::string& baseline) {
+    if (!step.waitForChange) return waitScript(step.waitFor, step.waitTimeoutMs);
+    return waitScript("{ " + DeviceProbe::screenChangedFrom(baseline) + " && " + step.waitFor + "; }",
+                      step.waitTimeoutMs);
+}
+
+std::vector<KeySequence> KeySequence::chunks(int maxDelayMs, size_t maxKeys) const {
+    std::vector<KeySequence> pieces;
+    KeySequence piece;
+    int pieceMs = 0;
+    for (const auto& step : steps) {
+        piece.steps.push_back(step);
+        pieceMs += step.delayMs;
+        if (!step.waitFor.empty() || pieceMs >= maxDelayMs || piece.size() >= maxKeys) {
+            pieces.push_back(std::move(piece));
+            piece = KeySequence();
+            pieceMs = 0;
+        }
+    }
+    if (!piece.empty()) pieces.push_back(std::move(piece));
+    return pieces;
+}
+
+int KeySequence::durationMs() const {
+    int total = 0;
+    for (const auto& step : steps) total += step.delayMs + step.waitTimeoutMs;
+    return total;
+}
+
+int KeySequence::send(AdbShell& adb, const std::string& label) const {
+    if (steps.empty()) return 0;
+
+    TraceEvents::Span span("keys", label);
+    span.arg("path", "adb input");
+    unsigned long trips = 0;
+    int status = 0;
+    size_t sent = 0;
+    for (const auto& piece : chunks(kCancelCheckMs)) {
+        if (Cancel::requested()) {
+            status = kCancelled;
+            break;
+        }
+        // Waits are part of the script here, so they count as key time
+        auto begin = ZapTrace::Clock::now();
+        ++trips;
+        status = adb.run(piece.toScript(), nullptr, piece.durationMs() + kRoundTripSlackMs);
+        ZapTrace::note("keys", begin);
+        // Later keys assume this piece landed, so a failure ends the sequence
+        if (status != 0) break;
+        ZapTrace::countKeys(piece.size());
+        sent += piece.size();
+    }
+    Log::info() << label << ": " << sent << (sent == 1 ? " key in " : " keys in ")
+                << trips << (trips == 1 ? " round trip" : " round trips")
+                << (status == kCancelled ? " (cancelled)" : status == 0 ? "" : " (failed)");
+    return status;
+}
@@ -0,0 +1,68 @@
+// Batched key navigation: a whole script of key presses, delays and waits
+// is sent to the device in one round trip
+#ifndef KEYSEQUENCE_H
+#define KEYSEQUENCE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "keys.h"
+#include "adbshell.h"
+
+struct KeyStep {
+    Key key;
+    int delayMs = 0;        // pause after the key (minimum settle time before waitFor)
+    std::string waitFor;    // optional device-side shell condition polled after the pause
+    int waitTimeoutMs = 0;
+    bool waitForChange = false; // waitFor also needs the screen to differ from before the key
+};
+
+class KeySequence {
+private:
+    std::vector<KeyStep> steps;
+
+public:
+    // send() result when a newer request cancelled the sequence (see cancel.h).
+    // Cancellation is only taken between chunks(), before the next one is
+    // sent, and a key with a wait always ends its chunk. So a cancelled
+    // sequence never sent its final key; callers rely on that (EON's
+    // DPAD_CENTER after a list walk).
+    static constexpr int kCancelled = -2;
+
+    KeySequence& press(Key key, int delayMs = 0);
+    KeySequence& repeat(Key key, int count, int delayMs = 0);
+    // Attach a condition to the last key: continue as soon as it holds
+    KeySequence& waitUntil(const std::string& condition, int timeoutMs);
+    // Like waitUntil, for keys that move to another screen: the screen must
+    // first differ from what it showed before the key (DeviceProbe::screenState),
+    // so a condition that already held does not end the wait at once
+    KeySequence& waitUntilChanged(const std::string& condition, int timeoutMs);
+    KeySequence& append(const KeySequence& other);
+    KeySequence& append(const KeyStep& step);
+
+    bool empty() const { return steps.empty(); }
+    size_t size() const { return steps.size(); }
+    const std::vector<KeyStep>& getSteps() const { return steps; }
+
+    // Device-side script; consecutive keys without delay share one `input keyevent`
+    std::string toScript() const;
+    // Upper bound on how long the script can run on the device
+    int durationMs() const;
+
+    // Splits after every wait and once delays add up to maxDelayMs, so a
+    // sender can check for cancellation between the pieces
+    std::vector<KeySequence> chunks(int maxDelayMs, size_t maxKeys = SIZE_MAX) const;
+
+    // Shell loop polling `condition` until it holds or timeoutMs passes on
+    // the device's clock, however long each poll takes
+    static std::string waitScript(const std::string& condition, int timeoutMs);
+    // The wait of `step`; `baseline` is a shell word with the screen state
+    // captured before its key (only used for waitForChange steps)
+    static std::string waitScript(const KeyStep& step, const std::string& baseline);
+
+    // Runs the sequence in as few shell round trips as cancellation allows
+    int send(AdbShell& adb, const std::string& label) const;
+};
+
+#endif
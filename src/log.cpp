@@ -0,0 +1,316 @@
+#include "log.h"
+
+#include <atomic>
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
+#include <thread>
+#include <time.h>
+#include <unistd.h>
+
+namespace {
+    const size_t kSlots = 1024;       // power of two
+    const size_t kTextMax = 496;      // one record, prefix and newline included
+    const size_t kCrashRecords = 200; // dumped by the crash handler
+    const int kMaxBatch = 64;         // records per writev
+
+    // A bounded MPSC queue (Vyukov's sequence-numbered ring). A slot whose
+    // sequence equals its position + 1 holds an unwritten record; once written
+    // it becomes position + kSlots, free for the producer one lap later, and
+    // its text stays readable for the crash dump until then.
+    struct Slot {
+        std::atomic<uint64_t> seq{0};
+        Log::Level level = Log::Level::Info;
+        uint32_t length = 0;
+        char text[kTextMax];
+    };
+
+    class Ring {
+    private:
+        Slot slots[kSlots];
+        std::atomic<uint64_t> enqueuePos{0};
+        uint64_t dequeuePos = 0; // writer thread only
+        std::atomic<uint64_t> dropped{0};
+        std::atomic<bool> sleeping{false};
+        std::atomic<bool> stopping{false};
+        int wakeFd = -1;
+        std::once_flag started;
+        std::thread writer;
+
+        void run();
+        size_t drain();
+        void start();
+
+    public:
+        const Log::Level threshold;
+
+        Ring();
+
+        // Returns false when the ring is full
+        bool push(Log::Level level, const char* text, size_t length);
+        void stop();
+        void dumpRecent(int fd) const;
+    };
+
+    Log::Level levelFromEnv() {
+        const char* value = std::getenv("WAYPI_LOG_LEVEL");
+        if (!value) return Log::Level::Info;
+        if (std::strcmp(value, "debug") == 0) return Log::Level::Debug;
+        if (std::strcmp(value, "warn") == 0) return Log::Level::Warn;
+        if (std::strcmp(value, "error") == 0) return Log::Level::Error;
+        return Log::Level::Info;
+    }
+
+    char levelChar(Log::Level level) {
+        switch (level) {
+            case Log::Level::Debug: return 'D';
+            case Log::Level::Info: return 'I';
+            case Log::Level::Warn: return 'W';
+            case Log::Level::Error: return 'E';
+            default: return '?';
+        }
+    }
+
+    // "[    12.345678] I text\n", cut to fit a slot
+    size_t format(char* out, Log::Level level, const std::string& text) {
+        timespec now{};
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        int prefix = std::snprintf(out, kTextMax, "[%6ld.%06ld] %c ", static_cast<long>(now.tv_sec),
+                                   now.tv_nsec / 1000, levelChar(level));
+        size_t length = prefix > 0 ? static_cast<size_t>(prefix) : 0;
+
+        size_t end = text.size();
+        while (end > 0 && text[end - 1] == '\n') --end;
+        size_t room = kTextMax - length - 1;
+        if (end > room) {
+            std::memcpy(out + length, text.data(), room - 3);
+            std::memcpy(out + length + room - 3, "...", 3);
+            length += room;
+        } else {
+            std::memcpy(out + length, text.data(), end);
+            length += end;
+        }
+        out[length++] = '\n';
+        return length;
+    }
+
+    bool writeAll(int fd, const char* data, size_t length) {
+        while (length > 0) {
+            ssize_t n = ::write(fd, data, length);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return false;
+            data += n;
+            length -= static_cast<size_t>(n);
+        }
+        return true;
+    }
+
+    Ring::Ring() : threshold(levelFromEnv()) {
+        for (size_t i = 0; i < kSlots; ++i) slots[i].seq.store(i, std::memory_order_relaxed);
+    }
+
+    void Ring::start() {
+        wakeFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        writer = std::thread([this] { run(); });
+    }
+
+    bool Ring::push(Log::Level level, const char* text, size_t length) {
+        // Exiting: nothing drains the ring any more
+        if (stopping.load()) {
+            return writeAll(level >= Log::Level::Warn ? STDERR_FILENO : STDOUT_FILENO, text, length);
+        }
+        std::call_once(started, [this] { start(); });
+
+        uint64_t pos = enqueuePos.load(std::memory_order_relaxed);
+        Slot* slot;
+        while (true) {
+            slot = &slots[pos & (kSlots - 1)];
+            uint64_t seq = slot->seq.load(std::memory_order_acquire);
+            int64_t diff = static_cast<int64_t>(seq) - static_cast<int64_t>(pos);
+            if (diff == 0) {
+                if (enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+            } else if (diff < 0) {
+                dropped.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            } else {
+                pos = enqueuePos.load(std::memory_order_relaxed);
+            }
+        }
+
+        slot->level = level;
+        slot->length = static_cast<uint32_t>(length);
+        std::memcpy(slot->text, text, length);
+        slot->seq.store(pos + 1, std::memory_order_release);
+
+        // Only a writer about to block needs the (one syscall) wakeup
+        if (sleeping.exchange(false)) {
+            uint64_t one = 1;
+            ssize_t n = ::write(wakeFd, &one, sizeof(one));
+            (void)n;
+        }
+        return true;
+    }
+
+    /// @brief Writes every record that is ready, in order, batching runs that
+    /// go to the same stream into one writev
+    /// @return number of records written
+    size_t Ring::drain() {
+        size_t written = 0;
+        while (true) {
+            iovec batch[kMaxBatch];
+            int count = 0;
+            int fd = -1;
+            uint64_t pos = dequeuePos;
+            while (count < kMaxBatch) {
+                Slot& slot = slots[pos & (kSlots - 1)];
+                if (slot.seq.load(std::memory_order_acquire) != pos + 1) break;
+                int slotFd = slot.level >= Log::Level::Warn ? STDERR_FILENO : STDOUT_FILENO;
+                if (fd >= 0 && slotFd != fd) break;
+                fd = slotFd;
+                batch[count].iov_base = slot.text;
+                batch[count].iov_len = slot.length;
+                ++count;
+                ++pos;
+            }
+            if (count == 0) break;
+
+            int done = 0;
+            while (done < count) {
+                ssize_t n = writev(fd, batch + done, count - done);
+                if (n < 0 && errno == EINTR) continue;
+                if (n <= 0) break; // stream gone; the records are dropped
+                size_t left = static_cast<size_t>(n);
+                while (done < count && left >= batch[done].iov_len) left -= batch[done++].iov_len;
+                if (done < count && left > 0) {
+                    batch[done].iov_base = static_cast<char*>(batch[done].iov_base) + left;
+                    batch[done].iov_len -= left;
+                }
+            }
+
+            for (int i = 0; i < count; ++i) {
+                slots[dequeuePos & (kSlots - 1)].seq.store(dequeuePos + kSlots, std::memory_order_release);
+                ++dequeuePos;
+            }
+            written += static_cast<size_t>(count);
+        }
+
+        uint64_t lost = dropped.exchange(0, std::memory_order_relaxed);
+        if (lost > 0) {
+            char text[kTextMax];
+            size_t length = format(text, Log::Level::Warn, std::to_string(lost) + " log records dropped (buffer full)");
+            writeAll(STDERR_FILENO, text, length);
+        }
+        return written;
+    }
+
+    void Ring::run() {
+        while (true) {
+            if (drain() > 0) continue;
+            if (stopping.load()) break;
+
+            sleeping.store(true);
+            // A record pushed before `sleeping` was visible did not wake us
+            if (slots[dequeuePos & (kSlots - 1)].seq.load(std::memory_order_acquire) == dequeuePos + 1) {
+                sleeping.store(false);
+                continue;
+            }
+            pollfd pfd{wakeFd, POLLIN, 0};
+            poll(&pfd, 1, -1);
+            uint64_t count;
+            ssize_t n = read(wakeFd, &count, sizeof(count));
+            (void)n;
+            sleeping.store(false);
+        }
+        drain();
+    }
+
+    void Ring::stop() {
+        if (!writer.joinable()) return;
+        stopping.store(true);
+        uint64_t one = 1;
+        ssize_t n = ::write(wakeFd, &one, sizeof(one));
+        (void)n;
+        writer.join();
+    }
+
+    void Ring::dumpRecent(int fd) const {
+        uint64_t end = enqueuePos.load(std::memory_order_acquire);
+        uint64_t begin = end > kCrashRecords ? end - kCrashRecords : 0;
+        for (uint64_t pos = begin; pos < end; ++pos) {
+            const Slot& slot = slots[pos & (kSlots - 1)];
+            uint64_t seq = slot.seq.load(std::memory_order_acquire);
+            // Queued or already written, and not yet reused
+            if (seq == pos + 1 || seq == pos + kSlots) writeAll(fd, slot.text, slot.length);
+        }
+    }
+
+    std::atomic<Ring*> crashRing{nullptr};
+
+    // Never destroyed: other threads may still log while the process exits
+    Ring& ring() {
+        static Ring* instance = [] {
+            Ring* r = new Ring();
+            crashRing.store(r);
+            std::atexit([] { ring().stop(); });
+            return r;
+        }();
+        return *instance;
+    }
+
+    // Decimal without stdio, for the signal handler
+    size_t formatInt(char* out, int value) {
+        char digits[12];
+        size_t n = 0;
+        unsigned v = value < 0 ? 0u : static_cast<unsigned>(value);
+        do {
+            digits[n++] = static_cast<char>('0' + v % 10);
+            v /= 10;
+        } while (v > 0);
+        for (size_t i = 0; i < n; ++i) out[i] = digits[n - 1 - i];
+        return n;
+    }
+
+    void onFatalSignal(int sig) {
+        char header[64] = "---- fatal signal ";
+        size_t length = std::strlen(header);
+        length += formatInt(header + length, sig);
+        const char tail[] = ", last log records: ----\n";
+        std::memcpy(header + length, tail, sizeof(tail) - 1);
+        length += sizeof(tail) - 1;
+        writeAll(STDERR_FILENO, header, length);
+
+        if (Ring* r = crashRing.load()) r->dumpRecent(STDERR_FILENO);
+        // SA_RESETHAND restored the default action (core dump, exit)
+        raise(sig);
+    }
+}
+
+bool Log::enabled(Level level) {
+    return level >= ring().threshold;
+}
+
+void Log::write(Level level, const std::string& text) {
+    char record[kTextMax];
+    size_t length = format(record, level, text);
+    ring().push(level, record, length);
+}
+
+void Log::dumpRecent(int fd) {
+    if (Ring* r = crashRing.load()) r->dumpRecent(fd);
+}
+
+void Log::installCrashHandler() {
+    ring();
+    struct sigaction action{};
+    action.sa_handler = onFatalSignal;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESETHAND;
+    for (int sig : {SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT}) sigaction(sig, &action, nullptr);
+}
@@ -0,0 +1,58 @@
+// Asynchronous logger: callers format a record and queue it in a lock-free
+// ring; one background thread writes the records to stdout (warnings and
+// errors to stderr). A slow terminal or journal therefore never blocks the
+// input or controller threads. Records carry a CLOCK_MONOTONIC timestamp,
+// the same clock as the keypad's evdev events. When the ring is full, new
+// records are dropped and counted instead of waiting.
+// The ring keeps the most recent records after they are written, so a crash
+// handler can dump them to stderr.
+#ifndef LOG_H
+#define LOG_H
+
+#include <sstream>
+#include <string>
+
+namespace Log {
+    enum class Level { Debug, Info, Warn, Error };
+
+    // WAYPI_LOG_LEVEL=debug|info|warn|error (default info)
+    bool enabled(Level level);
+
+    // Queues one record; never blocks
+    void write(Level level, const std::string& text);
+
+    // Writes the last records kept in the ring to `fd`; async-signal-safe
+    void dumpRecent(int fd);
+    // On SIGSEGV, SIGBUS, SIGFPE, SIGILL and SIGABRT, dumps the recent
+    // records to stderr before the default action
+    void installCrashHandler();
+
+    // One record, built with << and queued when it goes out of scope
+    class Line {
+    private:
+        Level level;
+        bool active;
+        std::ostringstream text;
+
+    public:
+        explicit Line(Level lineLevel) : level(lineLevel), active(enabled(lineLevel)) {}
+        ~Line() {
+            if (active) write(level, text.str());
+        }
+        Line(const Line&) = delete;
+        Line& operator=(const Line&) = delete;
+
+        template <typename T>
+        Line& operator<<(const T& value) {
+            if (active) text << value;
+            return *this;
+        }
+    };
+
+    inline Line debug() { return Line(Level::Debug); }
+    inline Line info() { return Line(Level::Info); }
+    inline Line warn() { return Line(Level::Warn); }
+    inline Line error() { return Line(Level::Error); }
+}
+
+#endif
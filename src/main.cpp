@@ -1,5 +1,12 @@
 #include "waydroid.h"
+#include "controller.h"
+#include "eventloop.h"
+#include "inputdevices.h"
+#include "channelinput.h"
+#include "zaphistory.h"
 #include "channels.h"
+#include "traceevents.h"
+#include "log.h"
 
 #include <iostream>
 #include <memory>
@@ -10,379 +17,261 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <linux/input.h>
-#include <dirent.h>
 #include <cstring>
 #include <cctype>
 #include <fstream>
 #include <limits.h>
 #include <sys/stat.h>
-#include <poll.h>
-#include <thread>
-#include <atomic>
+#include <cerrno>
+#include <csignal>
+#include <cstdlib>
+#include <functional>
 
 using namespace std;
 
-std::map<int, Channels> channelMap = {
-    {1, Channels::SVT1},
-    {2, Channels::SVT2},
-    {3, Channels::KUNSKAPSKANALEN},
-    {4, Channels::SVT24},
-    {5, Channels::EON_BN_MUZIKA},
-    {6, Channels::EON_BN},
-    {7, Channels::EON_HAPPY},
-    {8, Channels::EON_PRVA},
-    {9, Channels::EON_PINK},
-    {0, Channels::EON_RTS_1}
-};
-
-// Simplified device discovery: return all /dev/input/event* paths
-vector<string> findKeyboardDevices() {
-    DIR* dir = opendir("/dev/input");
-    if (!dir) {
-        cerr << "Cannot open /dev/input" << endl;
-        return {};
+// Terminal command handler: maps one typed line to an action
+void handleTerminalLine(Controller* controller, ChannelInput& channels, const std::string& line, EventLoop& loop) {
+    if (line.empty()) {
+        // Enter with no input -> DPAD_CENTER
+        Log::info() << "Terminal: DPAD_CENTER";
+        controller->requestKey(Key::DPAD_CENTER);
+        return;
     }
 
-    struct dirent* entry;
-    vector<string> devices;
-
-    while ((entry = readdir(dir)) != nullptr) {
-        if (strncmp(entry->d_name, "event", 5) == 0) {
-            devices.push_back(string("/dev/input/") + entry->d_name);
+    // Normalize to uppercase for single-letter commands
+    if (line.size() == 1) {
+        char c = std::toupper(static_cast<unsigned char>(line[0]));
+        switch (c) {
+            case 'N': // Enter
+                controller->requestStart();
+                return;
+            case 'M': // Backspace -> standby
+                controller->requestStandby();
+                return;
+            case 'X': // full stop
+                controller->requestStop();
+                return;
+            case 'W':
+                Log::info() << "Terminal: DPAD_UP";
+                controller->requestKey(Key::DPAD_UP);
+                return;
+            case 'A':
+                Log::info() << "Terminal: DPAD_LEFT";
+                controller->requestKey(Key::DPAD_LEFT);
+                return;
+            case 'S':
+                Log::info() << "Terminal: DPAD_DOWN";
+                controller->requestKey(Key::DPAD_DOWN);
+                return;
+            case 'D':
+                Log::info() << "Terminal: DPAD_RIGHT";
+                controller->requestKey(Key::DPAD_RIGHT);
+                return;
+            case 'Q':
+                Log::info() << "Terminal: BACK";
+                controller->requestKey(Key::BACK);
+                return;
+            case 'K':
+                Log::info() << "Terminal: ESC (stop)";
+                loop.stop();
+                return;
+            default:
+                break;
         }
     }
-    closedir(dir);
-    return devices;
+
+    // If the input is numeric (e.g. "1" or "10"), type it like on the numpad;
+    // the end of the line acts as Enter
+    bool allDigits = true;
+    for (char ch : line) if (!std::isdigit(static_cast<unsigned char>(ch))) { allDigits = false; break; }
+    if (allDigits && !line.empty()) {
+        for (char ch : line) channels.digit(ch - '0');
+        channels.enter();
+        return;
+    }
+
+    // Unknown command
+    Log::info() << "Terminal: unknown input '" << line << "'";
 }
 
-// Terminal input handler: polls stdin and maps typed commands to actions.
-void handleTerminalInput(Waydroid* w, std::atomic<bool>& keepRunning) {
-    struct pollfd pfd{STDIN_FILENO, POLLIN, 0};
-    std::string line;
+// Terminal input: stdin is read as it becomes readable and split into lines
+void watchTerminalInput(Controller* controller, ChannelInput& channels, EventLoop& loop,
+                        std::function<void()> onActivity) {
     // Show available terminal controls
-    std::cout << "Terminal controls:" << std::endl;
-    std::cout << "  [empty line] -> DPAD_CENTER" << std::endl;
-    std::cout << "  N -> Start Waydroid (Enter)" << std::endl;
-    std::cout << "  M -> Stop Waydroid (Backspace)" << std::endl;
-    std::cout << "  0-9 -> Change to mapped channel" << std::endl;
-    std::cout << "  W/A/S/D -> DPAD_UP/LEFT/DOWN/RIGHT" << std::endl;
-    std::cout << "  Q -> BACK" << std::endl;
-    std::cout << std::endl;
-    while (keepRunning) {
-        int pr = poll(&pfd, 1, 500);
-        if (pr < 0) {
-            perror("poll(stdin)");
-            break;
+    Log::info() << "Terminal controls:";
+    Log::info() << "  [empty line] -> DPAD_CENTER";
+    Log::info() << "  N -> Start Waydroid / resume from standby (Enter)";
+    Log::info() << "  M -> Standby (Backspace)";
+    Log::info() << "  X -> Stop Waydroid";
+    Log::info() << "  [number] -> Change to mapped channel";
+    Log::info() << "  W/A/S/D -> DPAD_UP/LEFT/DOWN/RIGHT";
+    Log::info() << "  Q -> BACK";
+
+    auto pending = std::make_shared<std::string>();
+    loop.add(STDIN_FILENO, [controller, &channels, &loop, pending, onActivity](uint32_t) {
+        char buf[256];
+        ssize_t n = read(STDIN_FILENO, buf, sizeof(buf));
+        if (n < 0 && errno == EINTR) return;
+        if (n <= 0) {
+            // EOF or error: keep serving the keypad without a terminal
+            loop.remove(STDIN_FILENO);
+            return;
         }
-        if (pr == 0) continue; // timeout
-        if (pfd.revents & POLLIN) {
-            if (!std::getline(std::cin, line)) {
-                // EOF or error
-                break;
-            }
 
-            if (line.empty()) {
-                // Enter with no input -> DPAD_CENTER
-                std::cout << "Terminal: DPAD_CENTER" << std::endl;
-                system("adb shell input keyevent KEYCODE_DPAD_CENTER");
-                continue;
-            }
+        pending->append(buf, static_cast<size_t>(n));
+        size_t newline;
+        while ((newline = pending->find('\n')) != std::string::npos) {
+            std::string line = pending->substr(0, newline);
+            pending->erase(0, newline + 1);
+            if (!line.empty() && line.back() == '\r') line.pop_back();
+            onActivity();
+            handleTerminalLine(controller, channels, line, loop);
+        }
+    });
+}
 
-            // Normalize to uppercase for single-letter commands
-            if (line.size() == 1) {
-                char c = std::toupper(static_cast<unsigned char>(line[0]));
-                switch (c) {
-                    case 'N': // Enter
-                        if (w->isRunning() && w->isConnectedAdb()) {
-                            std::cout << "Waydroid is already running!" << std::endl;
-                        } else {
-                            std::cout << "Starting Waydroid..." << std::endl;
-                            w->start();
-                        }
-                        continue;
-                    case 'M': // Backspace -> stop
-                        if (!w->isRunning() && !w->isConnectedAdb()) {
-                            std::cout << "Waydroid is not running!" << std::endl;
-                        } else {
-                            std::cout << "Stopping Waydroid..." << std::endl;
-                            w->stop();
-                        }
-                        continue;
-                    case 'W':
-                        std::cout << "Terminal: DPAD_UP" << std::endl;
-                        system("adb shell input keyevent KEYCODE_DPAD_UP");
-                        continue;
-                    case 'A':
-                        std::cout << "Terminal: DPAD_LEFT" << std::endl;
-                        system("adb shell input keyevent KEYCODE_DPAD_LEFT");
-                        continue;
-                    case 'S':
-                        std::cout << "Terminal: DPAD_DOWN" << std::endl;
-                        system("adb shell input keyevent KEYCODE_DPAD_DOWN");
-                        continue;
-                    case 'D':
-                        std::cout << "Terminal: DPAD_RIGHT" << std::endl;
-                        system("adb shell input keyevent KEYCODE_DPAD_RIGHT");
-                        continue;
-                    case 'Q':
-                        std::cout << "Terminal: BACK" << std::endl;
-                        system("adb shell input keyevent KEYCODE_BACK");
-                        continue;
-                    case 'K':
-                        std::cout << "Terminal: ESC (stop)" << std::endl;
-                        keepRunning = false;
-                        continue;
-                    default:
-                        break;
-                }
-            }
+// Keyboard event handler: maps one key press to an action
+void handleKeyEvent(Controller* controller, ChannelInput& channels, const input_event& ev, EventLoop& loop) {
+    if (ev.type != EV_KEY || ev.value == 0) return;
+    // Auto-repeat (value 2) only steps channels; a held +/- keeps stepping
+    if (ev.value == 2 && ev.code != KEY_KPPLUS && ev.code != KEY_KPMINUS) return;
 
-            // If the input is numeric (e.g. "1" or "0"), treat like numpad
-            bool allDigits = true;
-            for (char ch : line) if (!std::isdigit(static_cast<unsigned char>(ch))) { allDigits = false; break; }
-            if (allDigits && !line.empty()) {
-                int num = std::stoi(line);
-                if (num < 0 || num > 9) {
-                    std::cout << "Terminal: number out of 0-9 range" << std::endl;
-                    continue;
-                }
-                auto it = channelMap.find(num);
-                if (it != channelMap.end()) {
-                    if (!w->isRunning() || !w->isConnectedAdb()) {
-                        std::cout << "Cannot change channels - Waydroid is not running!" << std::endl;
-                        continue;
-                    }
-                    std::cout << "Terminal: Changing to channel " << num << std::endl;
-                    w->setChannel(it->second);
-                } else {
-                    std::cout << "Terminal: No channel mapped to " << num << std::endl;
-                }
-                continue;
-            }
+    switch (ev.code) {
+    case KEY_KPENTER: // Numpad Enter
+    case KEY_ENTER:   // Some keypads send regular Enter
+        // Confirms a channel number being typed, otherwise starts Waydroid
+        if (!channels.enter()) controller->requestStart();
+        break;
 
-            // Unknown command
-            std::cout << "Terminal: unknown input '" << line << "'" << std::endl;
-        }
-    }
-}
+    case KEY_BACKSPACE: // Backspace
+        controller->requestStandby();
+        break;
 
-// Function to handle keyboard input from multiple devices
-// keepRunning can be cleared to stop other input loops (terminal thread)
-void handleKeyboardInput(Waydroid* w, const vector<string>& devicePaths, std::atomic<bool>& keepRunning) {
-    if (devicePaths.empty()) {
-        cerr << "No keyboard devices found" << endl;
-        return;
+    case KEY_KP0: case KEY_KP1: case KEY_KP2: case KEY_KP3:
+    case KEY_KP4: case KEY_KP5: case KEY_KP6: case KEY_KP7:
+    case KEY_KP8: case KEY_KP9: {
+        // Map keypad keys to numbers 0-9
+        int num;
+        switch (ev.code) {
+            case KEY_KP0: num = 0; break;
+            case KEY_KP1: num = 1; break;
+            case KEY_KP2: num = 2; break;
+            case KEY_KP3: num = 3; break;
+            case KEY_KP4: num = 4; break;
+            case KEY_KP5: num = 5; break;
+            case KEY_KP6: num = 6; break;
+            case KEY_KP7: num = 7; break;
+            case KEY_KP8: num = 8; break;
+            case KEY_KP9: num = 9; break;
+            default: num = -1; break;
+        }                    
+        Log::info() << "Numpad key: " << num << " (code: " << ev.code << ")";
+        channels.digit(num, InputDevices::timeOf(ev));
+        break;
     }
 
-    vector<int> fds;
-    fds.reserve(devicePaths.size());
-    vector<pollfd> pfds;
-    pfds.reserve(devicePaths.size());
+    case KEY_KPPLUS: // Numpad Plus - next channel
+        channels.step(+1, InputDevices::timeOf(ev));
+        break;
 
-    for (const auto& path : devicePaths) {
-        int fd = open(path.c_str(), O_RDONLY);
-        if (fd < 0) {
-            cerr << "Cannot open device: " << path << endl;
-            fd = open(path.c_str(), O_RDWR);
-            if (fd < 0) {
-                cerr << "Also failed to open with O_RDWR: " << path << endl;
-                continue;
-            }
-        }
-        if (ioctl(fd, EVIOCGRAB, 1) == -1) {
-            perror((string("EVIOCGRAB failed for ") + path).c_str());
-        } else {
-            cout << "Grabbed: " << path << endl;
-        }
-        fds.push_back(fd);
-        pfds.push_back(pollfd{fd, POLLIN, 0});
-    }
+    case KEY_KPMINUS: // Numpad Minus - previous channel
+        channels.step(-1, InputDevices::timeOf(ev));
+        break;
 
-    if (fds.empty()) {
-        cerr << "Failed to open any keyboard devices" << endl;
-        return;
+    case KEY_ESC: // ESC to exit
+        Log::info() << "Exiting...";
+        loop.stop();
+        break;
     }
+}
 
-    cout << "Listening for numpad input..." << endl;
-    cout << "Numpad Enter: Start Waydroid" << endl;
-    cout << "Numpad Backspace: Stop Waydroid" << endl;
-    cout << "Numpad 1-3: Change channels" << endl;
-    cout << "Numpad +/-: Next/Previous channel" << endl;
-    cout << "ESC: Exit" << endl;
-    
-    struct input_event ev;
-    
-    while (keepRunning) {
-        int pr = poll(pfds.data(), pfds.size(), 500);
-        if (pr < 0) {
-            perror("poll");
-            break;
-        }
-        for (size_t i = 0; i < pfds.size(); ++i) {
-            if (!(pfds[i].revents & POLLIN)) continue;
-            ssize_t n = read(pfds[i].fd, &ev, sizeof(ev));
-            if (n != sizeof(ev)) {
-                continue;
-            }
-            // Only process key press events (not release or repeat)
-            if (ev.type == EV_KEY && ev.value == 1) {
-                switch (ev.code) {
-                case KEY_KPENTER: // Numpad Enter
-                case KEY_ENTER:   // Some keypads send regular Enter
-                    if (w->isRunning() && w->isConnectedAdb()) {
-                        cout << "Waydroid is already running!" << endl;
-                    } else {
-                        cout << "Starting Waydroid..." << endl;
-                        w->start();
-                    }
-                    break;
-                    
-                case KEY_BACKSPACE: // Backspace
-                    if (!w->isRunning() && !w->isConnectedAdb()) {
-                        cout << "Waydroid is not running!" << endl;
-                    } else {
-                        cout << "Stopping Waydroid..." << endl;
-                        w->stop();
-                    }
-                    break;
-                    
-                case KEY_KP0: case KEY_KP1: case KEY_KP2: case KEY_KP3:
-                case KEY_KP4: case KEY_KP5: case KEY_KP6: case KEY_KP7:
-                case KEY_KP8: case KEY_KP9: {
-                    if (!w->isRunning() || !w->isConnectedAdb()) {
-                        cout << "Cannot change channels - Waydroid is not running!" << endl;
-                        break;
-                    }
-                    
-                    // Map keypad keys to numbers 0-9
-                    int num;
-                    switch (ev.code) {
-                        case KEY_KP0: num = 0; break;
-                        case KEY_KP1: num = 1; break;
-                        case KEY_KP2: num = 2; break;
-                        case KEY_KP3: num = 3; break;
-                        case KEY_KP4: num = 4; break;
-                        case KEY_KP5: num = 5; break;
-                        case KEY_KP6: num = 6; break;
-                        case KEY_KP7: num = 7; break;
-                        case KEY_KP8: num = 8; break;
-                        case KEY_KP9: num = 9; break;
-                        default: num = -1; break;
-                    }                    
-                    cout << "Numpad key: " << num << " (code: " << ev.code << ")" << endl;
-                    
-                    // Check if this number is in the channelMap
-                    auto it = channelMap.find(num);
-                    if (it != channelMap.end()) {
-                        cout << "Changing to channel " << num << endl;
-                        w->setChannel(it->second);
-                    } else {
-                        cout << "No channel mapped to key " << num << endl;
-                    }
-                    break;
-                }
-                
-                case KEY_KPPLUS: { // Numpad Plus - next channel
-                    if (!w->isRunning() || !w->isConnectedAdb()) {
-                        cout << "Cannot change channels - Waydroid is not running!" << endl;
-                        break;
-                    }
-                    
-                    // Find current channel number
-                    int currentNum = -1;
-                    Channels currentChannel = w->getChannel();
-                    for (const auto& pair : channelMap) {
-                        if (pair.second == currentChannel) {
-                            currentNum = pair.first;
-                            break;
-                        }
-                    }
-                    
-                    // Find next channel in map
-                    auto it = channelMap.find(currentNum);
-                    if (it != channelMap.end()) {
-                        ++it;
-                    }
-                    
-                    // Wrap around to beginning if at end
-                    if (it == channelMap.end()) {
-                        it = channelMap.begin();
-                    }
-                    
-                    cout << "Channel up: changing to channel " << it->first << endl;
-                    w->setChannel(it->second);
-                    break;
-                }
-                
-                case KEY_KPMINUS: { // Numpad Minus - previous channel
-                    if (!w->isRunning() || !w->isConnectedAdb()) {
-                        cout << "Cannot change channels - Waydroid is not running!" << endl;
-                        break;
-                    }
-                    
-                    // Find current channel number
-                    int currentNum = -1;
-                    Channels currentChannel = w->getChannel();
-                    for (const auto& pair : channelMap) {
-                        if (pair.second == currentChannel) {
-                            currentNum = pair.first;
-                            break;
-                        }
-                    }
-                    
-                    // Find previous channel in map
-                    auto it = channelMap.find(currentNum);
-                    if (it != channelMap.end() && it != channelMap.begin()) {
-                        --it;
-                    } else {
-                        // Wrap around to end if at beginning
-                        it = channelMap.end();
-                        --it;
-                    }
-                    
-                    cout << "Channel down: changing to channel " << it->first << endl;
-                    w->setChannel(it->second);
-                    break;
-                }
-                
-                case KEY_ESC: // ESC to exit
-                    cout << "Exiting..." << endl;
-                    // signal terminal thread to stop
-                    keepRunning = false;
-                    // Release all and exit
-                    for (int fd : fds) {
-                        ioctl(fd, EVIOCGRAB, 0);
-                        close(fd);
-                    }
-                    return;
-                }
-            }
-        }
+void printKeypadControls() {
+    Log::info() << "Listening for numpad input...";
+    Log::info() << "Numpad Enter: Start Waydroid / resume from standby";
+    Log::info() << "Numpad Backspace: Standby";
+    Log::info() << "Numpad digits: Change channels (Enter or a short pause confirms)";
+    Log::info() << "Numpad +/-: Next/Previous channel";
+    Log::info() << "ESC: Exit";
+}
+
+// Idle time before automatic standby: WAYPI_STANDBY_AFTER_MIN minutes
+// (default 240, 0 disables)
+int standbyAfterMs() {
+    const char* value = getenv("WAYPI_STANDBY_AFTER_MIN");
+    int minutes = value ? atoi(value) : 240;
+    return minutes > 0 ? std::min(minutes, 10000) * 60 * 1000 : 0;
+}
+
+int main(int argc, char** argv) {
+    if (argc > 1 && string(argv[1]) == "--eon-zap-costs") {
+        EON::printZapCosts(cout);
+        return 0;
     }
-    
-    for (int fd : fds) {
-        ioctl(fd, EVIOCGRAB, 0);
-        close(fd);
+    if (argc > 1 && string(argv[1]) == "--zap-predictions") {
+        ZapHistory().printReplay(cout);
+        return 0;
     }
-}
+    // Terminal commands only, no keypad required (used by `make bench`)
+    const bool terminalOnly = argc > 1 && string(argv[1]) == "--terminal-only";
+
+    // Block SIGINT/SIGTERM before anything can start a thread (the logger and
+    // the trace writer start lazily), so every thread inherits the mask and
+    // the signals only arrive through the loop below
+    sigset_t exitSignals;
+    sigemptyset(&exitSignals);
+    sigaddset(&exitSignals, SIGINT);
+    sigaddset(&exitSignals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &exitSignals, nullptr);
+    Log::installCrashHandler();
+
+    // All input is dispatched from this thread
+    EventLoop loop;
+    loop.watchSignals({SIGINT, SIGTERM}, [&loop](int sig) {
+        Log::info() << "Received " << strsignal(sig) << ", exiting...";
+        loop.stop();
+    });
+    TraceEvents::nameThread("input");
 
-int main() {
     unique_ptr<Waydroid> w = make_unique<Waydroid>();
+    // Declared after w so its worker is joined before Waydroid is destroyed
+    Controller controller(*w);
     
-    // Find the keyboard devices (simplified: list event devices)
-    vector<string> keyboardDevices = findKeyboardDevices();
-    if (keyboardDevices.empty()) {
-        cerr << "No keyboard device found!" << endl;
-        return 1;
+    ChannelInput channels(controller, loop);
+
+    // Any input restarts the idle countdown to automatic standby
+    const int idleMs = standbyAfterMs();
+    int idleTimer = -1;
+    if (idleMs > 0) {
+        idleTimer = loop.addTimer([&controller] {
+            if (!controller.isRunning() || controller.isStandby()) return;
+            Log::info() << "No input for a while, entering standby";
+            controller.requestStandby();
+        });
     }
-    
-    // Start a terminal input thread and handle physical keyboard input
-    std::atomic<bool> keepRunning(true);
-    std::thread termThread(handleTerminalInput, w.get(), std::ref(keepRunning));
-    termThread.detach();
+    auto onActivity = [&loop, idleTimer, idleMs] {
+        if (idleTimer >= 0) loop.armTimer(idleTimer, idleMs);
+    };
+    onActivity();
 
-    // Handle keyboard input from all (blocks until ESC pressed)
-    handleKeyboardInput(w.get(), keyboardDevices, keepRunning);
-    
+    // Keypads are grabbed now and whenever one is plugged in later
+    InputDevices keypads(loop, [&controller, &channels, &loop, &onActivity](const vector<input_event>& frame) {
+        onActivity();
+        for (const auto& ev : frame) handleKeyEvent(&controller, channels, ev, loop);
+    });
+    if (!terminalOnly) {
+        if (!keypads.start()) {
+            Log::error() << "No keyboard device found!";
+            return 1;
+        }
+        if (keypads.count() == 0) {
+            Log::info() << "No keypad connected yet; waiting for one to be plugged in";
+        }
+    }
+
+    watchTerminalInput(&controller, channels, loop, onActivity);
+    if (!terminalOnly) printKeypadControls();
+
+    // Runs until ESC, K or a termination signal
+    loop.run();
     return 0;
 }
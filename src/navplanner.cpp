@@ -0,0 +1,104 @@
+#include "navplanner.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <functional>
+#include <iomanip>
+#include <limits>
+#include <queue>
+
+namespace {
+    struct Edge {
+        int to;
+        int costMs;
+        std::vector<Key> keys;
+    };
+
+    std::vector<Key> digitsOf(int position) {
+        std::vector<Key> keys;
+        for (char c : std::to_string(position)) keys.push_back(KeyUtil::digit(c - '0'));
+        return keys;
+    }
+}
+
+NavPlan NavPlanner::plan(int from, int to) const {
+    NavPlan result;
+    const int n = model.listLength;
+    if (from < 1 || to < 1 || from > n || to > n || from == to) return result;
+
+    auto edgesFrom = [&](int pos) {
+        std::vector<Edge> edges;
+        if (pos > 1) edges.push_back({pos - 1, model.stepCostMs, {Key::DPAD_UP}});
+        if (pos < n) edges.push_back({pos + 1, model.stepCostMs, {Key::DPAD_DOWN}});
+        if (model.pageSize > 0 && model.pageCostMs > 0) {
+            if (pos > 1) edges.push_back({std::max(1, pos - model.pageSize), model.pageCostMs, {Key::PAGE_UP}});
+            if (pos < n) edges.push_back({std::min(n, pos + model.pageSize), model.pageCostMs, {Key::PAGE_DOWN}});
+        }
+        if (model.homeCostMs > 0 && pos != 1) edges.push_back({1, model.homeCostMs, {Key::MOVE_HOME}});
+        if (model.endCostMs > 0 && pos != n) edges.push_back({n, model.endCostMs, {Key::MOVE_END}});
+        if (model.digitCostMs > 0 && pos != to) {
+            std::vector<Key> typed = digitsOf(to);
+            edges.push_back({to, model.digitCostMs * static_cast<int>(typed.size()), typed});
+        }
+        return edges;
+    };
+
+    const int inf = std::numeric_limits<int>::max();
+    std::vector<int> dist(n + 1, inf);
+    std::vector<int> prev(n + 1, -1);
+    std::vector<std::vector<Key>> via(n + 1);
+    using Item = std::pair<int, int>; // cost, position
+    std::priority_queue<Item, std::vector<Item>, std::greater<Item>> queue;
+
+    dist[from] = 0;
+    queue.push({0, from});
+    while (!queue.empty()) {
+        auto [cost, pos] = queue.top();
+        queue.pop();
+        if (cost > dist[pos]) continue;
+        if (pos == to) break;
+        for (auto& edge : edgesFrom(pos)) {
+            int next = cost + edge.costMs;
+            if (next < dist[edge.to]) {
+                dist[edge.to] = next;
+                prev[edge.to] = pos;
+                via[edge.to] = std::move(edge.keys);
+                queue.push({next, edge.to});
+            }
+        }
+    }
+
+    std::vector<int> path;
+    for (int pos = to; pos != from; pos = prev[pos]) path.push_back(pos);
+    std::reverse(path.begin(), path.end());
+
+    for (int pos : path) {
+        const auto& keys = via[pos];
+        int perKey = (dist[pos] - dist[prev[pos]]) / static_cast<int>(keys.size());
+        for (Key key : keys) result.keys.press(key, perKey);
+        result.keyCount += static_cast<int>(keys.size());
+    }
+    result.costMs = dist[to];
+    return result;
+}
+
+void NavPlanner::printCostTable(std::ostream& out, const std::vector<std::pair<std::string, int>>& channels) const {
+    out << std::left << std::setw(16) << "from" << std::setw(16) << "to"
+        << std::right << std::setw(10) << "dpad ms" << std::setw(10) << "plan ms"
+        << std::setw(8) << "keys" << std::endl;
+
+    long dpadTotal = 0, planTotal = 0;
+    for (const auto& src : channels) {
+        for (const auto& dst : channels) {
+            if (src.second == dst.second) continue;
+            NavPlan p = plan(src.second, dst.second);
+            int dpad = std::abs(dst.second - src.second) * model.stepCostMs;
+            dpadTotal += dpad;
+            planTotal += p.costMs;
+            out << std::left << std::setw(16) << src.first << std::setw(16) << dst.first
+                << std::right << std::setw(10) << dpad << std::setw(10) << p.costMs
+                << std::setw(8) << p.keyCount << std::endl;
+        }
+    }
+    out << "Total navigation: " << dpadTotal << " ms DPAD walking, " << planTotal << " ms planned" << std::endl;
+}
@@ -0,0 +1,44 @@
+// Cheapest key path between two positions of a vertical channel list
+#ifndef NAVPLANNER_H
+#define NAVPLANNER_H
+
+#include <string>
+#include <vector>
+#include <ostream>
+#include <utility>
+
+#include "keys.h"
+#include "keysequence.h"
+
+// Keys a list supports and how long each takes to settle (0 = unsupported)
+struct NavCostModel {
+    int listLength = 1;       // positions are 1..listLength
+    int stepCostMs = 500;     // DPAD_UP / DPAD_DOWN
+    int pageSize = 0;         // rows moved by PAGE_UP / PAGE_DOWN
+    int pageCostMs = 0;
+    int homeCostMs = 0;       // MOVE_HOME
+    int endCostMs = 0;        // MOVE_END (lands on listLength, so it must be exact)
+    int digitCostMs = 0;      // per digit when the list jumps to a typed position
+};
+
+struct NavPlan {
+    KeySequence keys;
+    int costMs = 0;
+    int keyCount = 0;
+};
+
+class NavPlanner {
+private:
+    NavCostModel model;
+
+public:
+    explicit NavPlanner(const NavCostModel& costModel) : model(costModel) {}
+
+    // Dijkstra over list positions; keys carry their settle time as delay
+    NavPlan plan(int from, int to) const;
+
+    // From/to matrix of planned zap costs against plain DPAD walking
+    void printCostTable(std::ostream& out, const std::vector<std::pair<std::string, int>>& channels) const;
+};
+
+#endif
@@ -0,0 +1,416 @@
+#include "playbackdetector.h"
+#include "cancel.h"
+#include "zapmetrics.h"
+#include "traceevents.h"
+#include "log.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <poll.h>
+#include <unistd.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace {
+    using Clock = std::chrono::steady_clock;
+
+    // Raw frames (no PNG encoding); stderr must not end up in the pixels
+    const char* const kCaptureLoop = "exec:while screencap 2>/dev/null; do :; done";
+
+    const size_t kGridWidth = 128;
+    const size_t kGridHeight = 72;
+    const size_t kRowsPerCell = 4;       // source rows averaged per grid row
+    const uint8_t kDarkLuma = 24;        // a cell this dark counts as black
+    const uint8_t kChangedLuma = 12;     // a cell changing by more than this moved
+    const double kBlackFraction = 0.98;  // dark cells in a black frame
+    const double kMotionFraction = 0.02; // moved cells between two playing frames
+    const int kMotionPairs = 2;          // consecutive moving pairs, so one UI change is not enough
+    const int kBlackStrikes = 2;         // all-black waits before giving up on the app
+    const int kPollSliceMs = 100;        // cancellation latency while reading
+    const uint32_t kMaxDimension = 8192;
+
+    // android::PixelFormat values screencap emits with 4 bytes per pixel
+    const uint32_t kRgba8888 = 1;
+    const uint32_t kRgbx8888 = 2;
+    const uint32_t kBgra8888 = 5;
+
+    struct FrameDiff {
+        uint64_t sumAbs = 0;
+        size_t changed = 0; // cells that differ by more than the threshold
+    };
+
+    struct Exposure {
+        uint64_t sum = 0;
+        size_t dark = 0; // cells at or below the dark level
+    };
+
+    // Scalar kernels; they also finish the tail the vector loops leave
+
+    // BT.601 luma in 8-bit fixed point (the weights sum to 256)
+    void lumaRowScalar(const uint8_t* rgba, size_t count, bool bgr, uint8_t* out) {
+        const unsigned w0 = bgr ? 29 : 77;
+        const unsigned w2 = bgr ? 77 : 29;
+        for (size_t i = 0; i < count; ++i, rgba += 4) {
+            out[i] = static_cast<uint8_t>((w0 * rgba[0] + 150 * rgba[1] + w2 * rgba[2] + 128) >> 8);
+        }
+    }
+
+    void compareScalar(const uint8_t* a, const uint8_t* b, size_t count, uint8_t threshold, FrameDiff& diff) {
+        for (size_t i = 0; i < count; ++i) {
+            unsigned d = a[i] > b[i] ? a[i] - b[i] : b[i] - a[i];
+            diff.sumAbs += d;
+            if (d > threshold) ++diff.changed;
+        }
+    }
+
+    void exposureScalar(const uint8_t* cells, size_t count, uint8_t darkLevel, Exposure& exposure) {
+        for (size_t i = 0; i < count; ++i) {
+            exposure.sum += cells[i];
+            if (cells[i] <= darkLevel) ++exposure.dark;
+        }
+    }
+
+#if defined(__SSE2__)
+    // Luma of 4 pixels as 32-bit lanes: madd gives (r*wr + g*wg, b*wb + 0) per pixel
+    inline __m128i luma4(__m128i px, __m128i weights) {
+        const __m128i zero = _mm_setzero_si128();
+        __m128i lo = _mm_madd_epi16(_mm_unpacklo_epi8(px, zero), weights);
+        __m128i hi = _mm_madd_epi16(_mm_unpackhi_epi8(px, zero), weights);
+        lo = _mm_add_epi32(lo, _mm_srli_epi64(lo, 32));
+        hi = _mm_add_epi32(hi, _mm_srli_epi64(hi, 32));
+        __m128i y = _mm_unpacklo_epi64(_mm_shuffle_epi32(lo, _MM_SHUFFLE(3, 1, 2, 0)),
+                                       _mm_shuffle_epi32(hi, _MM_SHUFFLE(3, 1, 2, 0)));
+        return _mm_srli_epi32(_mm_add_epi32(y, _mm_set1_epi32(128)), 8);
+    }
+
+    void lumaRow(const uint8_t* rgba, size_t count, bool bgr, uint8_t* out) {
+        const __m128i weights = bgr ? _mm_setr_epi16(29, 150, 77, 0, 29, 150, 77, 0)
+                                    : _mm_setr_epi16(77, 150, 29, 0, 77, 150, 29, 0);
+        size_t i = 0;
+        for (; i + 16 <= count; i += 16) {
+            const __m128i* src = reinterpret_cast<const __m128i*>(rgba + 4 * i);
+            __m128i y0 = luma4(_mm_loadu_si128(src), weights);
+            __m128i y1 = luma4(_mm_loadu_si128(src + 1), weights);
+            __m128i y2 = luma4(_mm_loadu_si128(src + 2), weights);
+            __m128i y3 = luma4(_mm_loadu_si128(src + 3), weights);
+            __m128i packed = _mm_packus_epi16(_mm_packs_epi32(y0, y1), _mm_packs_epi32(y2, y3));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), packed);
+        }
+        lumaRowScalar(rgba + 4 * i, count - i, bgr, out + i);
+    }
+
+    uint64_t sumLanes(__m128i sums) {
+        alignas(16) uint64_t lanes[2];
+        _mm_store_si128(reinterpret_cast<__m128i*>(lanes), sums);
+        return lanes[0] + lanes[1];
+    }
+
+    FrameDiff compare(const uint8_t* a, const uint8_t* b, size_t count, uint8_t threshold) {
+        FrameDiff diff;
+        const __m128i above = _mm_set1_epi8(static_cast<char>(threshold + 1));
+        __m128i sums = _mm_setzero_si128();
+        size_t i = 0;
+        for (; i + 16 <= count; i += 16) {
+            __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+            __m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+            sums = _mm_add_epi64(sums, _mm_sad_epu8(x, y));
+            __m128i d = _mm_or_si128(_mm_subs_epu8(x, y), _mm_subs_epu8(y, x));
+            // d > threshold <=> max(d, threshold + 1) == d
+            __m128i moved = _mm_cmpeq_epi8(_mm_max_epu8(d, above), d);
+            diff.changed += static_cast<size_t>(__builtin_popcount(_mm_movemask_epi8(moved)));
+        }
+        diff.sumAbs = sumLanes(sums);
+        compareScalar(a + i, b + i, count - i, threshold, diff);
+        return diff;
+    }
+
+    Exposure exposure(const uint8_t* cells, size_t count, uint8_t darkLevel) {
+        Exposure result;
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i level = _mm_set1_epi8(static_cast<char>(darkLevel));
+        __m128i sums = zero;
+        size_t i = 0;
+        for (; i + 16 <= count; i += 16) {
+            __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(cells + i));
+            sums = _mm_add_epi64(sums, _mm_sad_epu8(x, zero));
+            __m128i dark = _mm_cmpeq_epi8(_mm_min_epu8(x, level), x);
+            result.dark += static_cast<size_t>(__builtin_popcount(_mm_movemask_epi8(dark)));
+        }
+        result.sum = sumLanes(sums);
+        exposureScalar(cells + i, count - i, darkLevel, result);
+        return result;
+    }
+#elif defined(__ARM_NEON)
+    void lumaRow(const uint8_t* rgba, size_t count, bool bgr, uint8_t* out) {
+        const uint8x8_t wr = vdup_n_u8(77);
+        const uint8x8_t wg = vdup_n_u8(150);
+        const uint8x8_t wb = vdup_n_u8(29);
+        size_t i = 0;
+        for (; i + 16 <= count; i += 16) {
+            uint8x16x4_t px = vld4q_u8(rgba + 4 * i);
+            uint8x16_t r = bgr ? px.val[2] : px.val[0];
+            uint8x16_t b = bgr ? px.val[0] : px.val[2];
+            uint16x8_t lo = vmull_u8(vget_low_u8(r), wr);
+            lo = vmlal_u8(lo, vget_low_u8(px.val[1]), wg);
+            lo = vmlal_u8(lo, vget_low_u8(b), wb);
+            uint16x8_t hi = vmull_u8(vget_high_u8(r), wr);
+            hi = vmlal_u8(hi, vget_high_u8(px.val[1]), wg);
+            hi = vmlal_u8(hi, vget_high_u8(b), wb);
+            vst1q_u8(out + i, vcombine_u8(vrshrn_n_u16(lo, 8), vrshrn_n_u16(hi, 8)));
+        }
+        lumaRowScalar(rgba + 4 * i, count - i, bgr, out + i);
+    }
+
+    uint64_t sumLanes(uint32x4_t sums) {
+        uint32_t lanes[4];
+        vst1q_u32(lanes, sums);
+        return static_cast<uint64_t>(lanes[0]) + lanes[1] + lanes[2] + lanes[3];
+    }
+
+    // 32-bit lanes hold the sums of at most a few million 8-bit cells
+    FrameDiff compare(const uint8_t* a, const uint8_t* b, size_t count, uint8_t threshold) {
+        FrameDiff diff;
+        const uint8x16_t limit = vdupq_n_u8(threshold);
+        uint32x4_t sums = vdupq_n_u32(0);
+        uint32x4_t moved = vdupq_n_u32(0);
+        size_t i = 0;
+        for (; i + 16 <= count; i += 16) {
+            uint8x16_t d = vabdq_u8(vld1q_u8(a + i), vld1q_u8(b + i));
+            sums = vpadalq_u16(sums, vpaddlq_u8(d));
+            moved = vpadalq_u16(moved, vpaddlq_u8(vshrq_n_u8(vcgtq_u8(d, limit), 7)));
+        }
+        diff.sumAbs = sumLanes(sums);
+        diff.changed = static_cast<size_t>(sumLanes(moved));
+        compareScalar(a + i, b + i, count - i, threshold, diff);
+        return diff;
+    }
+
+    Exposure exposure(const uint8_t* cells, size_t count, uint8_t darkLevel) {
+        Exposure result;
+        const uint8x16_t level = vdupq_n_u8(darkLevel);
+        uint32x4_t sums = vdupq_n_u32(0);
+        uint32x4_t dark = vdupq_n_u32(0);
+        size_t i = 0;
+        for (; i + 16 <= count; i += 16) {
+            uint8x16_t x = vld1q_u8(cells + i);
+            sums = vpadalq_u16(sums, vpaddlq_u8(x));
+            dark = vpadalq_u16(dark, vpaddlq_u8(vshrq_n_u8(vcleq_u8(x, level), 7)));
+        }
+        result.sum = sumLanes(sums);
+        result.dark = static_cast<size_t>(sumLanes(dark));
+        exposureScalar(cells + i, count - i, darkLevel, result);
+        return result;
+    }
+#else
+    void lumaRow(const uint8_t* rgba, size_t count, bool bgr, uint8_t* out) {
+        lumaRowScalar(rgba, count, bgr, out);
+    }
+
+    FrameDiff compare(const uint8_t* a, const uint8_t* b, size_t count, uint8_t threshold) {
+        FrameDiff diff;
+        compareScalar(a, b, count, threshold, diff);
+        return diff;
+    }
+
+    Exposure exposure(const uint8_t* cells, size_t count, uint8_t darkLevel) {
+        Exposure result;
+        exposureScalar(cells, count, darkLevel, result);
+        return result;
+    }
+#endif
+
+    enum class ReadStatus { Ok, Closed, TimedOut, Cancelled };
+
+    ReadStatus readExact(int fd, uint8_t* data, size_t length, Clock::time_point deadline) {
+        while (length > 0) {
+            if (Cancel::requested()) return ReadStatus::Cancelled;
+            auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - Clock::now()).count();
+            if (left <= 0) return ReadStatus::TimedOut;
+
+            pollfd pfd{fd, POLLIN, 0};
+            int ready = poll(&pfd, 1, static_cast<int>(std::min<long long>(left, kPollSliceMs)));
+            if (ready < 0 && errno != EINTR) return ReadStatus::Closed;
+            if (ready <= 0) continue;
+
+            ssize_t n = read(fd, data, length);
+            if (n < 0 && (errno == EINTR || errno == EAGAIN)) continue;
+            if (n <= 0) return ReadStatus::Closed;
+            data += n;
+            length -= static_cast<size_t>(n);
+        }
+        return ReadStatus::Ok;
+    }
+
+    uint32_t littleEndian32(const uint8_t* p) {
+        return static_cast<uint32_t>(p[0]) | static_cast<uint32_t>(p[1]) << 8 |
+               static_cast<uint32_t>(p[2]) << 16 | static_cast<uint32_t>(p[3]) << 24;
+    }
+
+    long long msSince(Clock::time_point begin) {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - begin).count();
+    }
+}
+
+const char* toString(PlaybackDetector::Result result) {
+    switch (result) {
+        case PlaybackDetector::Result::Playing: return "playing";
+        case PlaybackDetector::Result::Still: return "still";
+        case PlaybackDetector::Result::Black: return "black";
+        case PlaybackDetector::Result::Unavailable: return "unavailable";
+        case PlaybackDetector::Result::Cancelled: return "cancelled";
+        default: return "unknown";
+    }
+}
+
+/// @brief screencap writes width, height and format, plus the dataspace
+/// since Android 9 (SDK 28)
+size_t PlaybackDetector::frameHeaderSize() {
+    if (headerSize == 0) {
+        std::string output;
+        int sdk = shell.run("getprop ro.build.version.sdk", &output) == 0 ? std::atoi(output.c_str()) : 0;
+        headerSize = sdk > 0 && sdk < 28 ? 12 : 16;
+    }
+    return headerSize;
+}
+
+/// @brief Averages the luma of `pixels` into the kGridWidth x kGridHeight grid,
+/// from kRowsPerCell source rows per grid row
+/// @return false for frames the grid cannot represent
+bool PlaybackDetector::downsample(uint32_t width, uint32_t height, uint32_t format) {
+    if (width < kGridWidth || height < kGridHeight) return false;
+    const bool bgr = format == kBgra8888;
+    const size_t stride = static_cast<size_t>(width) * 4;
+    luma.resize(width);
+    grid.resize(kGridWidth * kGridHeight);
+
+    std::vector<uint32_t> sums(kGridWidth);
+    for (size_t gy = 0; gy < kGridHeight; ++gy) {
+        const size_t top = gy * height / kGridHeight;
+        const size_t rows = std::min(kRowsPerCell, (gy + 1) * height / kGridHeight - top);
+        std::fill(sums.begin(), sums.end(), 0);
+        for (size_t r = 0; r < rows; ++r) {
+            const size_t y = top + r * ((gy + 1) * height / kGridHeight - top) / rows;
+            lumaRow(pixels.data() + y * stride, width, bgr, luma.data());
+            for (size_t gx = 0; gx < kGridWidth; ++gx) {
+                const size_t left = gx * width / kGridWidth;
+                const size_t right = (gx + 1) * width / kGridWidth;
+                uint32_t sum = 0;
+                for (size_t x = left; x < right; ++x) sum += luma[x];
+                sums[gx] += sum;
+            }
+        }
+        for (size_t gx = 0; gx < kGridWidth; ++gx) {
+            const size_t cells = rows * ((gx + 1) * width / kGridWidth - gx * width / kGridWidth);
+            grid[gy * kGridWidth + gx] = static_cast<uint8_t>(sums[gx] / cells);
+        }
+    }
+    return true;
+}
+
+/// @brief Reads frames from the capture stream `fd` until the picture moves
+PlaybackDetector::Result PlaybackDetector::watch(int fd, int timeoutMs, int& frames) {
+    const auto deadline = Clock::now() + std::chrono::milliseconds(timeoutMs);
+    const size_t cellCount = kGridWidth * kGridHeight;
+    std::vector<uint8_t> header(frameHeaderSize());
+    bool onlyBlack = true;
+    int movingPairs = 0;
+    previous.clear();
+
+    while (true) {
+        ReadStatus status = readExact(fd, header.data(), header.size(), deadline);
+        if (status == ReadStatus::Ok) {
+            const uint32_t width = littleEndian32(header.data());
+            const uint32_t height = littleEndian32(header.data() + 4);
+            const uint32_t format = littleEndian32(header.data() + 8);
+            if (width == 0 || height == 0 || width > kMaxDimension || height > kMaxDimension ||
+                (format != kRgba8888 && format != kRgbx8888 && format != kBgra8888)) {
+                Log::warn() << "Playback: unsupported screencap frame " << width << "x" << height
+                            << " format " << format;
+                disabled = true;
+                return Result::Unavailable;
+            }
+            pixels.resize(static_cast<size_t>(width) * height * 4);
+            status = readExact(fd, pixels.data(), pixels.size(), deadline);
+            if (status == ReadStatus::Ok && !downsample(width, height, format)) {
+                Log::warn() << "Playback: screencap frame " << width << "x" << height << " too small";
+                disabled = true;
+                return Result::Unavailable;
+            }
+        }
+        if (status == ReadStatus::Cancelled) return Result::Cancelled;
+        if (status == ReadStatus::Closed && frames == 0) {
+            // The capture loop ended without a frame: no usable screencap
+            Log::warn() << "Playback: screencap gave no frames";
+            disabled = true;
+            return Result::Unavailable;
+        }
+        if (status != ReadStatus::Ok) return onlyBlack && frames > 0 ? Result::Black : Result::Still;
+        ++frames;
+
+        const Exposure light = exposure(grid.data(), cellCount, kDarkLuma);
+        const bool black = light.dark >= kBlackFraction * cellCount;
+        onlyBlack = onlyBlack && black;
+
+        if (!previous.empty()) {
+            const FrameDiff diff = compare(previous.data(), grid.data(), cellCount, kChangedLuma);
+            const bool moving = !black && diff.changed >= kMotionFraction * cellCount;
+            movingPairs = moving ? movingPairs + 1 : 0;
+            if (movingPairs >= kMotionPairs) return Result::Playing;
+        }
+        previous.swap(grid);
+    }
+}
+
+/// @brief Waits for the picture to move, on a fresh capture stream
+PlaybackDetector::Result PlaybackDetector::waitForMotion(int timeoutMs, const std::string& label) {
+    if (disabled) return Result::Unavailable;
+    if (Cancel::requested()) return Result::Cancelled;
+    TraceEvents::Span span("wait", label + ": playback");
+    const auto begin = Clock::now();
+
+    const std::string serial = shell.getSerial();
+    if (serial.empty()) return Result::Unavailable;
+    int fd = -1;
+    AdbStatus status = shell.getClient().openService(serial, kCaptureLoop, fd);
+    if (status != AdbStatus::Ok) {
+        Log::warn() << label << ": cannot capture the screen: " << toString(status);
+        return Result::Unavailable;
+    }
+    int frames = 0;
+    Result result = watch(fd, timeoutMs, frames);
+    ::close(fd); // ends the capture loop on the device
+    ZapTrace::note("live", begin);
+    span.arg("result", toString(result));
+    span.arg("frames", frames);
+
+    switch (result) {
+        case Result::Playing:
+            blackStrikes = 0;
+            Log::info() << label << ": playing after " << msSince(begin) << " ms (" << frames << " frames)";
+            break;
+        case Result::Still:
+            blackStrikes = 0;
+            Log::warn() << label << ": no motion after " << msSince(begin) << " ms, continuing";
+            break;
+        case Result::Black:
+            Log::warn() << label << ": only black frames after " << msSince(begin) << " ms, continuing";
+            // Protected (DRM) video is black to screencap however long we wait
+            if (++blackStrikes >= kBlackStrikes) {
+                Log::warn() << label << ": video is not visible to screencap, no longer waiting for playback";
+                disabled = true;
+            }
+            break;
+        case Result::Unavailable:
+            Log::warn() << label << ": no longer waiting for playback";
+            break;
+        default:
+            break;
+    }
+    return result;
+}
@@ -0,0 +1,55 @@
+// Playback-start detection from screen captures.
+// One exec: stream runs screencap in a loop on the device and returns raw
+// frames back to back. Each frame is reduced to a small luma grid. Consecutive
+// grids are compared with SSE2/NEON kernels, with a scalar fallback. Once
+// the picture is not black and moves over consecutive frames, the video is
+// playing. This replaces fixed "let the stream start" delays after a zap.
+#ifndef PLAYBACKDETECTOR_H
+#define PLAYBACKDETECTOR_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "adbshell.h"
+
+class PlaybackDetector {
+public:
+    enum class Result {
+        Playing,     // the picture moved
+        Still,       // frames arrived but did not move before the deadline
+        Black,       // only black frames before the deadline
+        Unavailable, // no frames (screencap missing, adb down, or given up on)
+        Cancelled
+    };
+
+private:
+    AdbShell& shell;
+    size_t headerSize = 0; // raw screencap header, by SDK level
+    int blackStrikes = 0;
+    bool disabled = false;
+    std::vector<uint8_t> pixels;
+    std::vector<uint8_t> luma; // one sampled row
+    std::vector<uint8_t> grid;
+    std::vector<uint8_t> previous;
+
+    size_t frameHeaderSize();
+    Result watch(int fd, int timeoutMs, int& frames);
+    bool downsample(uint32_t width, uint32_t height, uint32_t format);
+
+public:
+    explicit PlaybackDetector(AdbShell& adbShell) : shell(adbShell) {}
+
+    PlaybackDetector(const PlaybackDetector&) = delete;
+    PlaybackDetector& operator=(const PlaybackDetector&) = delete;
+
+    // Blocks until the picture moves, timeoutMs passes or the zap is
+    // cancelled. The time is added to the bound zap's "live" stage. After
+    // repeated all-black waits (protected video is black to screencap) or
+    // when screencap gives no frames, later calls return Unavailable at once.
+    Result waitForMotion(int timeoutMs, const std::string& label);
+};
+
+const char* toString(PlaybackDetector::Result result);
+
+#endif
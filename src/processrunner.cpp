@@ -0,0 +1,216 @@
+#include "processrunner.h"
+#include "traceevents.h"
+#include "log.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <spawn.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+
+extern char** environ;
+
+namespace {
+    const size_t kReadChunk = 64 * 1024;
+    // Grace period between SIGTERM and SIGKILL for a child past its deadline
+    const int kTermGraceMs = 1000;
+    // Poll interval when pidfds are unavailable (kernels before 5.3)
+    const int kFallbackPollMs = 20;
+
+    using Clock = std::chrono::steady_clock;
+
+    int remainingMs(Clock::time_point deadline) {
+        auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - Clock::now()).count();
+        return left > 0 ? static_cast<int>(left) : 0;
+    }
+
+    int pidfdOpen(pid_t pid) {
+#ifdef SYS_pidfd_open
+        return static_cast<int>(syscall(SYS_pidfd_open, pid, 0));
+#else
+        (void)pid;
+        errno = ENOSYS;
+        return -1;
+#endif
+    }
+
+    int exitCodeOf(int status) {
+        if (WIFEXITED(status)) return WEXITSTATUS(status);
+        if (WIFSIGNALED(status)) return 128 + WTERMSIG(status);
+        return -1;
+    }
+
+    /// @brief posix_spawnp with stdin on /dev/null, stdout on `stdoutFd` (or
+    /// /dev/null if -1) and stderr inherited unless `quiet`
+    /// Signals blocked or handled by us (SIGINT/SIGTERM go to the signalfd) are
+    /// reset in the child, so `waydroid` can still be interrupted normally.
+    /// @return 0 or an errno value
+    int spawn(const std::vector<std::string>& argv, int stdoutFd, bool quiet, bool newSession, pid_t& pid) {
+        if (argv.empty()) return EINVAL;
+
+        std::vector<char*> args;
+        for (const auto& arg : argv) args.push_back(const_cast<char*>(arg.c_str()));
+        args.push_back(nullptr);
+
+        posix_spawn_file_actions_t actions;
+        posix_spawn_file_actions_init(&actions);
+        posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+        if (stdoutFd >= 0) {
+            posix_spawn_file_actions_adddup2(&actions, stdoutFd, STDOUT_FILENO);
+            posix_spawn_file_actions_addclose(&actions, stdoutFd);
+        } else {
+            posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+        }
+        if (quiet) posix_spawn_file_actions_addopen(&actions, STDERR_FILENO, "/dev/null", O_WRONLY, 0);
+
+        posix_spawnattr_t attr;
+        posix_spawnattr_init(&attr);
+        sigset_t none, all;
+        sigemptyset(&none);
+        sigfillset(&all);
+        posix_spawnattr_setsigmask(&attr, &none);
+        posix_spawnattr_setsigdefault(&attr, &all);
+        short flags = POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF;
+#ifdef POSIX_SPAWN_SETSID
+        // Own session: no SIGHUP when our terminal goes away (replaces nohup)
+        if (newSession) flags |= POSIX_SPAWN_SETSID;
+#else
+        (void)newSession;
+#endif
+        posix_spawnattr_setflags(&attr, flags);
+
+        int err = posix_spawnp(&pid, args[0], &actions, &attr, args.data(), environ);
+        posix_spawnattr_destroy(&attr);
+        posix_spawn_file_actions_destroy(&actions);
+        return err;
+    }
+
+    /// @brief Waits until `pid` exits or `deadline` passes, reading `outFd` into `output`
+    /// @return true and the wait status once reaped, false on deadline
+    bool collect(pid_t pid, int pidfd, int& outFd, std::string& output, Clock::time_point deadline, int& status) {
+        std::string chunk(kReadChunk, '\0');
+        while (true) {
+            pollfd fds[2];
+            nfds_t count = 0;
+            if (outFd >= 0) fds[count++] = pollfd{outFd, POLLIN, 0};
+            if (pidfd >= 0) fds[count++] = pollfd{pidfd, POLLIN, 0};
+
+            int timeout = remainingMs(deadline);
+            if (pidfd < 0) timeout = std::min(timeout, kFallbackPollMs);
+            int rc = poll(fds, count, timeout);
+            if (rc < 0 && errno != EINTR) return false;
+
+            if (outFd >= 0 && rc > 0 && (fds[0].revents & (POLLIN | POLLHUP | POLLERR))) {
+                ssize_t n = read(outFd, &chunk[0], chunk.size());
+                if (n > 0) {
+                    output.append(chunk, 0, static_cast<size_t>(n));
+                } else if (n == 0 || errno != EINTR) {
+                    close(outFd);
+                    outFd = -1;
+                }
+            }
+
+            // The pidfd turns readable on exit; without one, check every tick
+            if (waitpid(pid, &status, WNOHANG) == pid) return true;
+            if (remainingMs(deadline) == 0) return false;
+        }
+    }
+
+    // Takes whatever is already buffered; grandchildren may keep the pipe open
+    void drain(int outFd, std::string& output) {
+        std::string chunk(kReadChunk, '\0');
+        pollfd pfd{outFd, POLLIN, 0};
+        while (poll(&pfd, 1, 0) > 0 && (pfd.revents & POLLIN)) {
+            ssize_t n = read(outFd, &chunk[0], chunk.size());
+            if (n <= 0) break;
+            output.append(chunk, 0, static_cast<size_t>(n));
+        }
+    }
+}
+
+std::string ProcessRunner::describe(const std::vector<std::string>& argv) {
+    std::string text;
+    for (const auto& arg : argv) {
+        if (!text.empty()) text += ' ';
+        text += arg;
+    }
+    return text;
+}
+
+ProcessRunner::Result ProcessRunner::run(const std::vector<std::string>& argv, int timeoutMs) {
+    Result result;
+    TraceEvents::Span span("spawn", TraceEvents::enabled() ? describe(argv) : std::string());
+    int pipeFds[2];
+    if (pipe2(pipeFds, O_CLOEXEC) != 0) {
+        Log::error() << describe(argv) << ": pipe failed: " << std::strerror(errno);
+        return result;
+    }
+
+    pid_t pid = -1;
+    int err = spawn(argv, pipeFds[1], false, false, pid);
+    close(pipeFds[1]);
+    if (err != 0) {
+        close(pipeFds[0]);
+        Log::error() << describe(argv) << ": " << std::strerror(err);
+        return result;
+    }
+
+    int outFd = pipeFds[0];
+    int pidfd = pidfdOpen(pid);
+    auto deadline = Clock::now() + std::chrono::milliseconds(timeoutMs);
+    int status = 0;
+    if (collect(pid, pidfd, outFd, result.output, deadline, status)) {
+        result.exitCode = exitCodeOf(status);
+    } else {
+        result.timedOut = true;
+        Log::warn() << describe(argv) << ": no exit after " << timeoutMs << " ms, terminating";
+        kill(pid, SIGTERM);
+        if (!collect(pid, pidfd, outFd, result.output, Clock::now() + std::chrono::milliseconds(kTermGraceMs), status)) {
+            kill(pid, SIGKILL);
+            waitpid(pid, &status, 0);
+        }
+        result.exitCode = exitCodeOf(status);
+    }
+
+    if (outFd >= 0) {
+        drain(outFd, result.output);
+        close(outFd);
+    }
+    if (pidfd >= 0) close(pidfd);
+    span.arg("exit", result.exitCode);
+    if (result.timedOut) span.arg("timed out", "yes");
+    return result;
+}
+
+pid_t ProcessRunner::spawnDetached(const std::vector<std::string>& argv) {
+    const auto begin = TraceEvents::Clock::now();
+    pid_t pid = -1;
+    int err = spawn(argv, -1, true, true, pid);
+    if (err != 0) {
+        Log::error() << describe(argv) << ": " << std::strerror(err);
+        return -1;
+    }
+
+    // Nothing else waits for it, so reap it here instead of leaving a zombie
+    // It outlives the caller's spans, so the trace gives it a track of its own
+    std::string name;
+    if (TraceEvents::enabled()) {
+        name = describe(argv);
+        TraceEvents::instant("spawn", name, {{"pid", std::to_string(pid)}});
+        TraceEvents::nameThread(name, pid);
+    }
+    std::thread([pid, begin, name] {
+        int status = 0;
+        while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {}
+        TraceEvents::complete("spawn", name, begin, TraceEvents::Clock::now(),
+                              {{"exit", std::to_string(exitCodeOf(status))}}, pid);
+    }).detach();
+    return pid;
+}
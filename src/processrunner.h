@@ -0,0 +1,34 @@
+// Host commands (waydroid, adb) without a shell in between.
+// Children are started with posix_spawn, get stdin from /dev/null and a clean
+// signal mask, and are reaped through a pidfd. Every run() has a deadline: a
+// child that overruns it gets SIGTERM, then SIGKILL, so a hung CLI cannot
+// stall the caller.
+#ifndef PROCESSRUNNER_H
+#define PROCESSRUNNER_H
+
+#include <string>
+#include <sys/types.h>
+#include <vector>
+
+namespace ProcessRunner {
+    struct Result {
+        int exitCode = -1;     // exit status, 128 + signal if killed, -1 if never started
+        bool timedOut = false;
+        std::string output;    // stdout
+        bool ok() const { return exitCode == 0 && !timedOut; }
+    };
+
+    // Runs argv[0] (looked up on PATH) and waits at most timeoutMs for it to exit.
+    // stderr stays on ours; stdout is captured into Result::output.
+    Result run(const std::vector<std::string>& argv, int timeoutMs);
+
+    // Starts a long-lived child in its own session with stdout/stderr on
+    // /dev/null. It is reaped by a background thread when it exits.
+    // Returns its pid, or -1 if it could not be started.
+    pid_t spawnDetached(const std::vector<std::string>& argv);
+
+    // "waydroid app launch pkg" style, for log messages
+    std::string describe(const std::vector<std::string>& argv);
+}
+
+#endif
@@ -0,0 +1,50 @@
+#include "stagetimer.h"
+#include "traceevents.h"
+#include "log.h"
+
+#include <iomanip>
+#include <utility>
+
+namespace {
+    long long msBetween(StageTimer::Clock::time_point a, StageTimer::Clock::time_point b) {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(b - a).count();
+    }
+}
+
+StageTimer::StageTimer(std::string name) : label(std::move(name)), origin(Clock::now()) {}
+
+StageTimer::Stage StageTimer::begin(const std::string& stage) {
+    std::lock_guard<std::mutex> lock(mtx);
+    records.push_back(Record{stage, Clock::now(), Clock::time_point(), false, TraceEvents::currentTid()});
+    return Stage(this, records.size() - 1);
+}
+
+void StageTimer::Stage::end() {
+    if (!timer) return;
+    timer->finish(index);
+    timer = nullptr;
+}
+
+void StageTimer::finish(size_t index) {
+    std::lock_guard<std::mutex> lock(mtx);
+    Record& record = records[index];
+    if (record.done) return;
+    record.end = Clock::now();
+    record.done = true;
+    TraceEvents::complete("stage", label + ": " + record.name, record.begin, record.end, {}, record.tid);
+}
+
+void StageTimer::report() {
+    std::lock_guard<std::mutex> lock(mtx);
+    Log::info() << label << " finished in " << msBetween(origin, Clock::now()) << " ms";
+    for (const auto& record : records) {
+        Log::Line line(Log::Level::Info);
+        line << "  " << std::left << std::setw(20) << record.name << std::right
+             << " +" << std::setw(6) << msBetween(origin, record.begin) << " ms  ";
+        if (record.done) {
+            line << std::setw(6) << msBetween(record.begin, record.end) << " ms";
+        } else {
+            line << "  (still running)";
+        }
+    }
+}
@@ -0,0 +1,54 @@
+// Per-stage wall-clock timing for multi-stage operations (e.g. Waydroid boot)
+#ifndef STAGETIMER_H
+#define STAGETIMER_H
+
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <vector>
+
+class StageTimer {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    // RAII handle: the stage ends when it goes out of scope (or at end())
+    class Stage {
+    private:
+        StageTimer* timer;
+        size_t index;
+
+    public:
+        Stage(StageTimer* owner, size_t slot) : timer(owner), index(slot) {}
+        Stage(Stage&& other) noexcept : timer(other.timer), index(other.index) { other.timer = nullptr; }
+        Stage(const Stage&) = delete;
+        Stage& operator=(const Stage&) = delete;
+        ~Stage() { end(); }
+
+        void end();
+    };
+
+private:
+    struct Record {
+        std::string name;
+        Clock::time_point begin;
+        Clock::time_point end;
+        bool done = false;
+        long tid = 0; // thread the stage began on, for the trace
+    };
+
+    std::string label;
+    Clock::time_point origin;
+    std::vector<Record> records;
+    std::mutex mtx;
+
+    void finish(size_t index);
+
+public:
+    explicit StageTimer(std::string name);
+
+    Stage begin(const std::string& stage);
+    // Prints every stage's offset from the start and its own duration
+    void report();
+};
+
+#endif
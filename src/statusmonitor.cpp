@@ -0,0 +1,181 @@
+#include "statusmonitor.h"
+#include "processrunner.h"
+#include "traceevents.h"
+#include "log.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <poll.h>
+#include <sstream>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+namespace {
+    // Waydroid's config/session files and the LXC container directory (its log
+    // and state files are rewritten on every container transition)
+    const char* const kStateDirs[] = {"/var/lib/waydroid", "/var/lib/waydroid/lxc/waydroid"};
+    const int kStatusProbeMs = 30000; // fallback when inotify saw nothing
+    const int kSettleMs = 250;        // let a burst of file events finish first
+    const int kStatusTimeoutMs = 10000;
+    // waydroid.log and the LXC logs change on every CLI call, `waydroid status` included
+    const char* const kIgnoredSuffix = ".log";
+
+    using Clock = std::chrono::steady_clock;
+
+    std::string trim(const std::string& str) {
+        // Include all whitespace characters: space, tab, newline, carriage return, form feed, vertical tab
+        const std::string whitespace = " \t\n\r\f\v";
+
+        size_t first = str.find_first_not_of(whitespace);
+        if (std::string::npos == first) {
+            return "";  // String is all whitespace
+        }
+
+        size_t last = str.find_last_not_of(whitespace);
+        return str.substr(first, (last - first + 1));
+    }
+}
+
+StatusMonitor::StatusMonitor() : snapshot(std::make_shared<const Snapshot>()) {}
+
+StatusMonitor::~StatusMonitor() {
+    stopping = true;
+    poke();
+    if (thread.joinable()) thread.join();
+    if (inotifyFd >= 0) close(inotifyFd);
+    if (wakeFd >= 0) close(wakeFd);
+}
+
+void StatusMonitor::start() {
+    if (thread.joinable()) return;
+    wakeFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    watchStateDirs();
+    thread = std::thread([this] { loop(); });
+}
+
+void StatusMonitor::watchStateDirs() {
+    inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotifyFd < 0) return;
+
+    int watched = 0;
+    for (const char* dir : kStateDirs) {
+        if (inotify_add_watch(inotifyFd, dir, IN_CREATE | IN_DELETE | IN_CLOSE_WRITE | IN_MODIFY | IN_MOVED_TO) >= 0) {
+            ++watched;
+        }
+    }
+    if (watched == 0) {
+        Log::info() << "Status monitor: no Waydroid state directory to watch, probing every "
+                    << kStatusProbeMs / 1000 << " s";
+        close(inotifyFd);
+        inotifyFd = -1;
+    }
+}
+
+void StatusMonitor::poke() {
+    if (wakeFd < 0) return;
+    uint64_t one = 1;
+    ssize_t n = write(wakeFd, &one, sizeof(one));
+    (void)n;
+}
+
+void StatusMonitor::loop() {
+    TraceEvents::nameThread("status monitor");
+    auto statusDue = Clock::now() + std::chrono::milliseconds(kStatusProbeMs);
+
+    while (!stopping) {
+        auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(statusDue - Clock::now()).count();
+
+        pollfd fds[2] = {{wakeFd, POLLIN, 0}, {inotifyFd, POLLIN, 0}};
+        int rc = poll(fds, inotifyFd >= 0 ? 2 : 1, static_cast<int>(std::max<long long>(wait, 0)));
+        if (rc < 0 && errno != EINTR) break;
+        if (stopping) break;
+
+        if (rc > 0 && (fds[0].revents & POLLIN)) {
+            uint64_t count;
+            ssize_t n = read(wakeFd, &count, sizeof(count));
+            (void)n;
+            statusDue = Clock::now();
+        }
+        if (rc > 0 && (fds[1].revents & POLLIN) && drainStateEvents()) {
+            statusDue = std::min(statusDue, Clock::now() + std::chrono::milliseconds(kSettleMs));
+        }
+
+        if (Clock::now() >= statusDue) {
+            refresh();
+            statusDue = Clock::now() + std::chrono::milliseconds(kStatusProbeMs);
+        }
+    }
+}
+
+/// @brief Reads all pending inotify events
+/// @return true if a file other than a log changed
+bool StatusMonitor::drainStateEvents() {
+    bool changed = false;
+    alignas(inotify_event) char buffer[4096];
+    ssize_t n;
+    while ((n = read(inotifyFd, buffer, sizeof(buffer))) > 0) {
+        for (char* p = buffer; p < buffer + n;) {
+            const inotify_event* event = reinterpret_cast<const inotify_event*>(p);
+            p += sizeof(inotify_event) + event->len;
+
+            std::string name = event->len > 0 ? event->name : "";
+            const size_t suffixLen = std::strlen(kIgnoredSuffix);
+            bool isLog = name.size() >= suffixLen &&
+                         name.compare(name.size() - suffixLen, suffixLen, kIgnoredSuffix) == 0;
+            if (!isLog) changed = true;
+        }
+    }
+    return changed;
+}
+
+void StatusMonitor::refresh() {
+    std::lock_guard<std::mutex> lock(probeMtx);
+    Snapshot status;
+    if (probeStatus(status)) publish(status);
+}
+
+/// @brief Runs `waydroid status` and parses it into status
+/// @return false if it timed out (status is then meaningless)
+bool StatusMonitor::probeStatus(Snapshot& status) {
+    ProcessRunner::Result result = ProcessRunner::run({"waydroid", "status"}, kStatusTimeoutMs);
+    if (result.timedOut) {
+        Log::warn() << "waydroid status timed out; keeping the last known state";
+        return false;
+    }
+
+    // Parse the output line by line
+    std::istringstream iss(result.output);
+    std::string line;
+    while (std::getline(iss, line)) {
+        // Find the colon separator
+        size_t colonPos = line.find(':');
+        if (colonPos == std::string::npos) continue;
+
+        std::string key = trim(line.substr(0, colonPos));
+        std::string value = trim(line.substr(colonPos + 1));
+        if (key == "Session") {
+            status.session = value;
+        } else if (key == "Container") {
+            status.container = value;
+        } else if (key == "IP address") {
+            status.ip = value;
+        }
+    }
+    return true;
+}
+
+void StatusMonitor::publish(const Snapshot& next) {
+    std::shared_ptr<const Snapshot> previous = current();
+    if (previous->session != next.session || previous->container != next.container || previous->ip != next.ip) {
+        Log::info() << "Parsed Status - Session: " << next.session
+                    << ", Container: " << next.container
+                    << ", IP: " << next.ip;
+        TraceEvents::instant("state", "Waydroid " + next.session + "/" + next.container,
+                             {{"session", next.session}, {"container", next.container}, {"ip", next.ip}});
+    }
+    std::atomic_store(&snapshot, std::make_shared<const Snapshot>(next));
+}
@@ -0,0 +1,64 @@
+// Background view of the Waydroid session and container.
+// A monitor thread re-reads `waydroid status` when files in Waydroid's state
+// directories change (inotify; logs excluded, since every CLI call, the
+// probe's own included, appends to them) and otherwise only every 30 s. Each
+// change is published as an immutable snapshot, so readers never block on a
+// probe. A probe that times out keeps the previous snapshot.
+// The adb transport is tracked separately by AdbConnection.
+#ifndef STATUSMONITOR_H
+#define STATUSMONITOR_H
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+class StatusMonitor {
+public:
+    struct Snapshot {
+        std::string session = "UNKNOWN";
+        std::string container = "UNKNOWN";
+        std::string ip = "UNKNOWN";
+
+        // A frozen container (standby) is still up
+        bool running() const {
+            return session == "RUNNING" && (container == "RUNNING" || container == "FROZEN");
+        }
+        bool hasIp() const { return !ip.empty() && ip != "UNKNOWN"; }
+        std::string adbSerial() const { return ip + ":5555"; } // IP is typically 192.168.240.112
+    };
+
+private:
+    std::shared_ptr<const Snapshot> snapshot; // only accessed with atomic_load/atomic_store
+    std::mutex probeMtx;                      // one probe at a time (monitor or caller)
+    std::atomic<bool> stopping{false};
+    int inotifyFd = -1;
+    int wakeFd = -1;
+    std::thread thread;
+
+    void loop();
+    void watchStateDirs();
+    bool drainStateEvents();
+    bool probeStatus(Snapshot& status);
+    void publish(const Snapshot& next);
+
+public:
+    StatusMonitor();
+    ~StatusMonitor();
+
+    StatusMonitor(const StatusMonitor&) = delete;
+    StatusMonitor& operator=(const StatusMonitor&) = delete;
+
+    // Starts the monitor thread (after an initial refresh())
+    void start();
+
+    std::shared_ptr<const Snapshot> current() const { return std::atomic_load(&snapshot); }
+
+    // Probes now on the calling thread, for callers waiting on a change
+    void refresh();
+    // Asks the monitor thread to probe soon (e.g. after the adb link dropped)
+    void poke();
+};
+
+#endif
@@ -0,0 +1,150 @@
+#include "traceevents.h"
+#include "log.h"
+
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace {
+    // The JSON array format; the closing bracket is optional for both viewers
+    class Writer {
+    private:
+        std::mutex mtx;
+        FILE* file = nullptr;
+        std::atomic<bool> open{false};
+        const TraceEvents::Clock::time_point origin = TraceEvents::Clock::now();
+        const long pid = static_cast<long>(getpid());
+
+    public:
+        Writer() {
+            const char* path = std::getenv("WAYPI_TRACE");
+            if (!path || !*path) return;
+            file = std::fopen(path, "we");
+            if (!file) {
+                Log::error() << "Trace: cannot write " << path << ": " << std::strerror(errno);
+                return;
+            }
+            std::fprintf(file, "[\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%ld,\"tid\":%ld,"
+                               "\"args\":{\"name\":\"waypi\"}}", pid, pid);
+            std::fflush(file);
+            open = true;
+            Log::info() << "Trace: writing " << path;
+        }
+
+        // At exit; detached threads may still try to write afterwards
+        void finish() {
+            std::lock_guard<std::mutex> lock(mtx);
+            if (!file) return;
+            open = false;
+            std::fputs("\n]\n", file);
+            std::fclose(file);
+            file = nullptr;
+        }
+
+        bool isOpen() const { return open; }
+
+        long long micros(TraceEvents::Clock::time_point t) const {
+            return std::chrono::duration_cast<std::chrono::microseconds>(t - origin).count();
+        }
+
+        // `fields` is the body of the event after pid and tid
+        void write(long tid, const std::string& fields) {
+            std::lock_guard<std::mutex> lock(mtx);
+            if (!file) return;
+            std::fprintf(file, ",\n{\"pid\":%ld,\"tid\":%ld,%s}", pid, tid, fields.c_str());
+            std::fflush(file);
+        }
+    };
+
+    // Never destroyed, so late writers find it intact
+    Writer& writer() {
+        static Writer* instance = [] {
+            Writer* w = new Writer();
+            std::atexit([] { writer().finish(); });
+            return w;
+        }();
+        return *instance;
+    }
+
+    std::string quoted(const std::string& text) {
+        std::string out = "\"";
+        for (unsigned char c : text) {
+            switch (c) {
+                case '"': out += "\\\""; break;
+                case '\\': out += "\\\\"; break;
+                case '\n': out += "\\n"; break;
+                case '\t': out += "\\t"; break;
+                default:
+                    if (c < 0x20) {
+                        char escaped[8];
+                        std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+                        out += escaped;
+                    } else {
+                        out += static_cast<char>(c);
+                    }
+            }
+        }
+        return out + "\"";
+    }
+
+    std::string argsJson(const TraceEvents::Args& args) {
+        std::string out = "{";
+        for (const auto& arg : args) {
+            if (out.size() > 1) out += ',';
+            out += quoted(arg.first) + ":" + quoted(arg.second);
+        }
+        return out + "}";
+    }
+}
+
+bool TraceEvents::enabled() {
+    return writer().isOpen();
+}
+
+long TraceEvents::currentTid() {
+    thread_local const long tid = static_cast<long>(syscall(SYS_gettid));
+    return tid;
+}
+
+void TraceEvents::nameThread(const std::string& name, long tid) {
+    if (!enabled()) return;
+    writer().write(tid ? tid : currentTid(), "\"name\":\"thread_name\",\"ph\":\"M\",\"args\":{\"name\":" + quoted(name) + "}");
+}
+
+void TraceEvents::complete(const char* category, const std::string& name, Clock::time_point begin,
+                           Clock::time_point end, const Args& args, long tid) {
+    if (!enabled()) return;
+    Writer& w = writer();
+    w.write(tid ? tid : currentTid(),
+            "\"name\":" + quoted(name) + ",\"cat\":" + quoted(category) + ",\"ph\":\"X\",\"ts\":" +
+            std::to_string(w.micros(begin)) + ",\"dur\":" + std::to_string(w.micros(end) - w.micros(begin)) +
+            ",\"args\":" + argsJson(args));
+}
+
+void TraceEvents::instant(const char* category, const std::string& name, const Args& args) {
+    if (!enabled()) return;
+    Writer& w = writer();
+    w.write(currentTid(),
+            "\"name\":" + quoted(name) + ",\"cat\":" + quoted(category) + ",\"ph\":\"i\",\"s\":\"t\",\"ts\":" +
+            std::to_string(w.micros(Clock::now())) + ",\"args\":" + argsJson(args));
+}
+
+TraceEvents::Span::Span(const char* spanCategory, const std::string& spanName)
+    : active(enabled()), category(spanCategory) {
+    if (!active) return;
+    name = spanName;
+    begin = Clock::now();
+}
+
+TraceEvents::Span::~Span() {
+    if (active) complete(category, name, begin, Clock::now(), args);
+}
+
+void TraceEvents::Span::arg(const std::string& key, const std::string& value) {
+    if (active) args.emplace_back(key, value);
+}
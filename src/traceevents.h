@@ -0,0 +1,51 @@
+// Opt-in Chrome trace-event export (WAYPI_TRACE=<file>).
+// Spawned commands, device shell commands, injected keys, waits and the
+// state transitions of Waydroid and the apps are written as trace events
+// with their thread ids, for chrome://tracing or ui.perfetto.dev. Events are
+// appended as they finish, so a trace cut short by a crash still loads.
+// Without WAYPI_TRACE every call returns after one check.
+#ifndef TRACEEVENTS_H
+#define TRACEEVENTS_H
+
+#include <chrono>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace TraceEvents {
+    using Clock = std::chrono::steady_clock;
+    using Args = std::vector<std::pair<std::string, std::string>>;
+
+    bool enabled();
+    long currentTid();
+
+    // Names a thread in the trace; `tid` defaults to the calling thread
+    void nameThread(const std::string& name, long tid = 0);
+
+    // A finished span ("X" event); `tid` defaults to the calling thread
+    void complete(const char* category, const std::string& name, Clock::time_point begin,
+                  Clock::time_point end, const Args& args = {}, long tid = 0);
+    // A point in time ("i" event), e.g. a state change
+    void instant(const char* category, const std::string& name, const Args& args = {});
+
+    // Times its own scope; args can be added until it ends
+    class Span {
+    private:
+        bool active;
+        const char* category;
+        std::string name;
+        Clock::time_point begin;
+        Args args;
+
+    public:
+        Span(const char* spanCategory, const std::string& spanName);
+        ~Span();
+        Span(const Span&) = delete;
+        Span& operator=(const Span&) = delete;
+
+        void arg(const std::string& key, const std::string& value);
+        void arg(const std::string& key, long long value) { arg(key, std::to_string(value)); }
+    };
+}
+
+#endif
@@ -0,0 +1,51 @@
+#include "wait.h"
+#include "cancel.h"
+#include "zapmetrics.h"
+#include "traceevents.h"
+#include "log.h"
+
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+bool Wait::until(const std::function<bool()>& ready, int timeoutMs, const std::string& label,
+                 const Backoff& backoff) {
+    using Clock = std::chrono::steady_clock;
+    const auto begin = Clock::now();
+    const auto deadline = begin + std::chrono::milliseconds(timeoutMs);
+    double intervalMs = backoff.initialMs;
+    TraceEvents::Span span("wait", label);
+    int polls = 0;
+
+    while (true) {
+        ++polls;
+        if (ready()) {
+            span.arg("result", "ready");
+            span.arg("polls", polls);
+            ZapTrace::note("wait", begin);
+            auto waited = std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - begin);
+            Log::info() << label << ": ready after " << waited.count() << " ms";
+            return true;
+        }
+
+        if (Cancel::requested()) {
+            span.arg("result", "cancelled");
+            ZapTrace::note("wait", begin);
+            Log::info() << label << ": cancelled";
+            return false;
+        }
+
+        auto now = Clock::now();
+        if (now >= deadline) break;
+        auto pause = std::min(std::chrono::milliseconds(static_cast<int>(intervalMs)),
+                              std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now));
+        std::this_thread::sleep_for(pause);
+        intervalMs = std::min(intervalMs * backoff.factor, static_cast<double>(backoff.maxMs));
+    }
+
+    span.arg("result", "timed out");
+    span.arg("polls", polls);
+    ZapTrace::note("wait", begin);
+    Log::warn() << label << ": not ready after " << timeoutMs << " ms, continuing";
+    return false;
+}
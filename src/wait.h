@@ -0,0 +1,21 @@
+// Deadline-bounded polling with adaptive backoff, used instead of fixed sleeps
+#ifndef WAIT_H
+#define WAIT_H
+
+#include <functional>
+#include <string>
+
+namespace Wait {
+    struct Backoff {
+        int initialMs = 50;  // first re-poll interval
+        int maxMs = 1000;    // interval cap
+        double factor = 1.5; // growth per unsuccessful poll
+    };
+
+    // Polls `ready` until it returns true or timeoutMs elapses.
+    // Returns true as soon as the condition holds, false on timeout or cancellation.
+    bool until(const std::function<bool()>& ready, int timeoutMs, const std::string& label,
+               const Backoff& backoff = Backoff());
+}
+
+#endif
@@ -1,6 +1,14 @@
 #include "waydroid.h"
-#include <sys/select.h>
-#include <sys/time.h>
+#include "deviceprobe.h"
+#include "wait.h"
+#include "stagetimer.h"
+#include "cancel.h"
+#include "processrunner.h"
+#include "zapmetrics.h"
+#include "traceevents.h"
+#include "log.h"
+#include <chrono>
+#include <future>
 // unistd.h likely already included through headers for usleep/STDIN_FILENO, but include explicitly for clarity
 #include <unistd.h>
 #include <signal.h>
@@ -9,314 +17,381 @@
 #include <cstdlib>
 
 Waydroid::Waydroid() {
-    parseStatus();
+    status.refresh();
+    status.start();
 }
 
 Waydroid::~Waydroid() {
     stop();
 }
 
-std::string Waydroid::executeCommand(const std::string& command) {
-    std::array<char, 128> buffer;
-    std::string result;
-    
-    std::unique_ptr<FILE, decltype(&pclose)> pipe(popen(command.c_str(), "r"), pclose);
-    if (!pipe) {
-        throw std::runtime_error("popen() failed!");
-    }
-    
-    while (fgets(buffer.data(), buffer.size(), pipe.get()) != nullptr) {
-        result += buffer.data();
-    }
-    
-    return result;
-}
-
-
-std::string Waydroid::trim(const std::string& str) {
-    // Include all whitespace characters: space, tab, newline, carriage return, form feed, vertical tab
-    const std::string whitespace = " \t\n\r\f\v";
-    
-    size_t first = str.find_first_not_of(whitespace);
-    if (std::string::npos == first) {
-        return "";  // String is all whitespace
-    }
-    
-    size_t last = str.find_last_not_of(whitespace);
-    return str.substr(first, (last - first + 1));
-}
-
-void Waydroid::parseStatus() {
-    try {
-        // Execute waydroid status command
-        std::string output = executeCommand("waydroid status");
-        
-        sessionStatus = "UNKNOWN";
-        containerStatus = "UNKNOWN";
-        ipAddress = "UNKNOWN";
-
-        // Parse the output line by line
-        std::istringstream iss(output);
-        std::string line;
-        
-        while (std::getline(iss, line)) {
-            // Find the colon separator
-            size_t colonPos = line.find(':');
-            if (colonPos != std::string::npos) {
-                std::string key = trim(line.substr(0, colonPos));
-                std::string value = trim(line.substr(colonPos + 1));
-                
-                // Parse based on the key
-                if (key == "Session") {
-                    sessionStatus = value;
-                } else if (key == "Container") {
-                    containerStatus = value;
-                } else if (key == "IP address") {
-                    ipAddress = value;
-                }
-            }
-        }
-        
-        // Debug output to show what was parsed
-        std::cout << "Parsed Status - Session: " << sessionStatus 
-                  << ", Container: " << containerStatus 
-                  << ", IP: " << ipAddress << std::endl;
-                  
-    } catch (const std::exception& e) {
-        std::cerr << "Error parsing waydroid status: " << e.what() << std::endl;
-        sessionStatus = "UNKNOWN";
-        containerStatus = "UNKNOWN";
-        ipAddress = "UNKNOWN";
-    }
+namespace {
+    // Deadlines for the waydroid CLI; a hung call fails instead of blocking the controller
+    const int kSessionStopTimeoutMs = 30000;
+    const int kFreezeTimeoutMs = 10000;
+    const int kHookTimeoutMs = 10000;
 }
 
 /// @brief Starts Waydroid session and connects with adb
-/// @return true if already running, false if started successfully
+/// Boot runs as overlapping stages: the adb server starts while the session
+/// boots, adb connects as soon as the container has an IP, and the UI opens
+/// while Android is still booting. Each stage's duration is reported.
+/// @return true if already running, false if it was started (or failed to start)
 bool Waydroid::start() {
     if (isRunning() && isConnectedAdb()) {
-        std::cout << "Already running" << std::endl;
+        Log::info() << "Already running";
+        // An earlier start may have given up on the injector
+        if (!keyInjector.isResident()) keyInjector.deploy(adbClient, adbSerial());
+        while (auto ch = takePendingOrFinishStart()) setChannel(*ch);
         return true;
     }
 
-    if (!isRunning()) {
-        int result = system("nohup waydroid session start > /dev/null 2>&1 &");
-        if (result == 0) {
-            system("sleep 5");
-            std::cout << "Waydroid session start command issued..." << std::endl;
+    starting = true;
+    TraceEvents::Span span("waydroid", "start");
+    StageTimer timing("Waydroid start");
+    const Wait::Backoff poll{250, 2000, 1.5};
+
+    // Off the critical path: the adb server is only needed once the container has an IP
+    std::future<void> adbServer = std::async(std::launch::async, [this, &timing] {
+        TraceEvents::nameThread("start: adb server");
+        auto stage = timing.begin("adb server");
+        adbClient.startServer();
+    });
 
-            // Open the UI window (separate from the session)
-            std::cout << "Starting Waydroid UI..." << std::endl;
+    if (!isRunning()) {
+        auto session = timing.begin("session start");
+        // Runs for the life of the session, so it is left in the background
+        pid_t sessionPid = ProcessRunner::spawnDetached({"waydroid", "session", "start"});
+        session.end();
+        if (sessionPid > 0) {
+            Log::info() << "Waydroid session start command issued...";
+            // Container is up once status reports it running with an IP
+            auto container = timing.begin("container");
+            Wait::until([this] {
+                status.refresh();
+                return isRunning() && status.current()->hasIp();
+            }, 60000, "Waydroid: container", poll);
+            container.end();
+
+            // Open the UI window (separate from the session); Android keeps booting behind it
+            Log::info() << "Starting Waydroid UI...";
+            auto ui = timing.begin("ui");
             showUI();
-            system("sleep 8");
         } else {
-            std::cerr << "Failed to start waydroid session" << std::endl;
+            // Nothing is booting, so the adb, container and boot waits would only time out
+            Log::error() << "Failed to start waydroid session";
+            status.refresh();
+            adbServer.wait();
+            while (auto ch = takePendingOrFinishStart()) {
+                Log::warn() << "Dropping queued channel " << ChannelUtil::name(*ch);
+            }
+            return false;
         }
-        parseStatus();
     }
+    adbServer.wait();
 
     if (!isConnectedAdb()) {
-        std::cout << "Connecting ADB" << std::endl;
-        connectAdb();
+        Log::info() << "Connecting ADB";
+        // adbd comes up a little after the container reports an IP
+        auto stage = timing.begin("adb connect");
+        Wait::until([this] {
+            connectAdb();
+            return isConnectedAdb();
+        }, 30000, "Waydroid: adb", poll);
+    }
+
+    // A channel requested during boot starts its app as soon as apps can be
+    // launched, overlapped with the rest of the boot
+    std::future<void> firstChannel;
+    if (isConnectedAdb()) {
+        auto stage = timing.begin("package manager");
+        Wait::until([this] { return DeviceProbe::check(adbShell, DeviceProbe::packageManagerReady()); },
+                    90000, "Waydroid: package manager", poll);
+        stage.end();
+
+        if (auto ch = takePendingChannel()) {
+            firstChannel = std::async(std::launch::async, [this, &timing, ch] {
+                TraceEvents::nameThread("start: first channel");
+                auto stage = timing.begin("first channel");
+                setChannel(*ch);
+            });
+        }
+    }
+
+    if (isConnectedAdb()) {
+        auto stage = timing.begin("boot completed");
+        Wait::until([this] { return DeviceProbe::check(adbShell, DeviceProbe::bootCompleted()); },
+                    90000, "Waydroid: boot completed", poll);
+    }
+
+    if (isConnectedAdb() && !keyInjector.isResident()) {
+        auto stage = timing.begin("key injector");
+        keyInjector.deploy(adbClient, adbSerial());
+    }
+
+    if (firstChannel.valid()) firstChannel.wait();
+    timing.report();
+
+    // Requests that arrived while the first channel was tuning
+    while (auto ch = takePendingOrFinishStart()) {
+        if (isConnectedAdb()) setChannel(*ch);
     }
     return false;
 }
 
+std::optional<Channels> Waydroid::takePendingChannel() {
+    std::lock_guard<std::mutex> lock(pendingMtx);
+    std::optional<Channels> ch = pendingChannel;
+    pendingChannel.reset();
+    return ch;
+}
+
+/// @brief Takes the pending channel, or leaves the starting state if none is left
+/// Both happen under the same lock as requestChannel(), so no request is lost
+std::optional<Channels> Waydroid::takePendingOrFinishStart() {
+    std::lock_guard<std::mutex> lock(pendingMtx);
+    std::optional<Channels> ch = pendingChannel;
+    pendingChannel.reset();
+    if (!ch) starting = false;
+    return ch;
+}
+
+bool Waydroid::deferChannel(Channels ch) {
+    std::lock_guard<std::mutex> lock(pendingMtx);
+    if (!starting) return false;
+
+    if (pendingChannel) {
+        Log::info() << "Replacing queued channel " << ChannelUtil::name(*pendingChannel);
+    }
+    pendingChannel = ch;
+    Log::info() << "Waydroid is starting; " << ChannelUtil::name(ch) << " will be tuned when ready";
+    return true;
+}
+
 /// @brief Stops Waydroid session
 /// @return true if already stopped, false if stopped successfully
 bool Waydroid::stop() {
-    if (!isRunning() && !isConnectedAdb()) {
+    if (!isRunning() && !adbLink.isWanted()) {
         return true;
     }
+    TraceEvents::Span span("waydroid", "stop");
 
-    runningApp.release();
+    // A frozen container cannot shut down cleanly
+    if (frozen) resume();
 
-    // Stop Adb
-    if (isConnectedAdb()) {
+    // Force-stops the pooled apps while adb is still up
+    foregroundApp = nullptr;
+    apps.clear();
+
+    keyInjector.disconnect();
+
+    // Stop Adb (also while it is down and being reconnected)
+    if (adbLink.isWanted()) {
         disconnectAdb();
     }
 
     // Stop Waydroid
     if (isRunning()) {
-        int result = system("waydroid session stop");
-    
-        if (result == 0) {
-            std::cout << "Waydroid session stop command issued..." << std::endl;
+        if (ProcessRunner::run({"waydroid", "session", "stop"}, kSessionStopTimeoutMs).ok()) {
+            Log::info() << "Waydroid session stop command issued...";
         } else {
-            std::cerr << "Failed to stop waydroid session" << std::endl;
+            Log::error() << "Failed to stop waydroid session";
         }
-        parseStatus();
+        status.refresh();
     }
 
     return false;
 }
 
-bool Waydroid::isRunning() {
-    return (sessionStatus == "RUNNING" && containerStatus == "RUNNING");
+/// @brief Freezes the container after turning the Android screen off
+/// WAYPI_BLANK_CMD, if set, is run as well (e.g. to power off the display)
+/// @return true if the container is frozen
+bool Waydroid::standby() {
+    if (frozen) return true;
+    if (!isRunning()) return false;
+    TraceEvents::Span span("waydroid", "standby");
+
+    auto begin = std::chrono::steady_clock::now();
+    // Screen off first, so the frozen frame is black and playback is paused
+    adbShell.run("input keyevent KEYCODE_SLEEP", nullptr, 5000);
+    runHook("WAYPI_BLANK_CMD");
+
+    if (!ProcessRunner::run({"waydroid", "container", "freeze"}, kFreezeTimeoutMs).ok()) {
+        Log::error() << "Failed to freeze waydroid container";
+        runHook("WAYPI_UNBLANK_CMD");
+        adbShell.run("input keyevent KEYCODE_WAKEUP", nullptr, 5000);
+        span.arg("result", "freeze failed");
+        return false;
+    }
+    frozen = true;
+    // adbd is frozen too; a silent transport is expected, not an outage
+    adbLink.setPaused(true);
+    Log::info() << "Standby after " << std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - begin).count() << " ms";
+    return true;
 }
 
-void Waydroid::connectAdb() {
-    if (!ipAddress.empty() && ipAddress != "UNKNOWN") {
-        std::string adbCommand = "adb connect " + ipAddress + ":5555";  // IP is typically 192.168.240.112
-        int adbResult = system(adbCommand.c_str());
-        
-        if (adbResult == 0) 
-            adbConnected = true;
+/// @brief Thaws the container and wakes the screen; adb, the key injector and
+/// the apps were never stopped, so playback continues where it was
+bool Waydroid::resume() {
+    if (!frozen) return true;
+    TraceEvents::Span span("waydroid", "resume");
+
+    auto begin = std::chrono::steady_clock::now();
+    if (!ProcessRunner::run({"waydroid", "container", "unfreeze"}, kFreezeTimeoutMs).ok()) {
+        Log::error() << "Failed to unfreeze waydroid container";
+        span.arg("result", "unfreeze failed");
+        return false;
+    }
+    frozen = false;
+    adbLink.setPaused(false);
+    runHook("WAYPI_UNBLANK_CMD");
+    adbShell.run("input keyevent KEYCODE_WAKEUP", nullptr, 5000);
+    Log::info() << "Resumed from standby in " << std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - begin).count() << " ms";
+    return true;
+}
+
+// Runs the shell command in environment variable `name`, if set. The hook is
+// user-written shell, so this is the one place that still goes through sh.
+void Waydroid::runHook(const char* name) {
+    const char* command = std::getenv(name);
+    if (!command || !*command) return;
+    if (!ProcessRunner::run({"/bin/sh", "-c", command}, kHookTimeoutMs).ok()) {
+        Log::error() << name << " failed: " << command;
+    }
+}
 
+bool Waydroid::isRunning() const {
+    return status.current()->running();
+}
+
+void Waydroid::connectAdb() {
+    if (status.current()->hasIp()) {
+        if (adbLink.connect(adbSerial())) adbShell.open(adbSerial());
     } else {
-        std::cerr << "No valid IP address found for ADB connection" << std::endl;
+        Log::error() << "No valid IP address found for ADB connection";
     }
 }
 
 void Waydroid::disconnectAdb() {
-    if (!ipAddress.empty() && ipAddress != "UNKNOWN") {
-        std::string adbCommand = "adb disconnect " + ipAddress + ":5555";
-        int adbResult = system(adbCommand.c_str());
-        
-        if (adbResult == 0) 
-            adbConnected = false;
+    adbShell.close();
+    adbLink.disconnect();
 
-    } else {
-        std::cerr << "No valid IP address found for ADB connection" << std::endl;
+    AdbConnection::Stats stats = adbLink.stats();
+    if (stats.reconnects > 0) {
+        Log::info() << "adb link: " << stats.reconnects << " reconnects, "
+                    << stats.downtimeMs << " ms down";
     }
 }
 
-bool Waydroid::isConnectedAdb() {
-    return adbConnected;
+bool Waydroid::isConnectedAdb() const {
+    // Kept current by the keepalive; reading it never blocks
+    return adbLink.isUp();
 }
 
 void Waydroid::setChannel(Channels ch) {
     if (!isConnectedAdb() && !isRunning()) {
-        std::cerr << "Could not set channel, Waydroid not running or adb not connected" << std::endl;
+        Log::error() << "Could not set channel, Waydroid not running or adb not connected";
         return;
     }
 
     // Decide which app should own this channel
     auto appId = ChannelUtil::appFor(ch);
+    App* app = appFor(appId);
+    if (!app) {
+        Log::error() << "No app owns channel " << ChannelUtil::name(ch);
+        return;
+    }
 
-    // Create or switch app instance if necessary
-    if (appId == ChannelUtil::AppId::SVT) {
-        SVT* svtPtr = dynamic_cast<SVT*>(runningApp.get());
-        if (!svtPtr) {
-            runningApp = std::make_unique<SVT>();
-            svtPtr = static_cast<SVT*>(runningApp.get());
-            svtPtr->start();
-        }
-        svtPtr->setChannel(ch);
-    } else if (appId == ChannelUtil::AppId::EON) {
-        EON* eonPtr = dynamic_cast<EON*>(runningApp.get());
-        if (!eonPtr) {
-            runningApp = std::make_unique<EON>();
-            eonPtr = static_cast<EON*>(runningApp.get());
-            eonPtr->start();
+    // Apps stay resident: switching back to one resumes its task where it was.
+    // App start is never cancelled halfway; a newer request takes over once the app is up.
+    appSwitch = AppSwitch::None;
+    appSwitchMs = 0;
+    if (app != foregroundApp || !app->isRunning()) {
+        Cancel::Scope uncancellable{Cancel::Token()};
+        auto begin = std::chrono::steady_clock::now();
+        if (app->isRunning() && app->resume()) {
+            appSwitch = AppSwitch::Resumed;
+        } else {
+            app->start();
+            appSwitch = AppSwitch::Started;
         }
-        eonPtr->setChannel(ch);
-    } else {
-        // Unknown channel: stop and reset app
-        runningApp.reset();
+        appSwitchMs = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - begin).count();
+        ZapTrace::note("app", begin);
+        foregroundApp = app;
     }
+    if (Cancel::requested()) return;
+    app->setChannel(ch);
 
+    if (Cancel::requested()) return;
     currentChannel = ch;
+    // The zap is done when the new stream plays, not when the last key is sent
+    app->waitUntilPlaying();
 }
 
-Channels Waydroid::getChannel() {
-    if (runningApp) {
-        if (auto* svt = dynamic_cast<SVT*>(runningApp.get())) return svt->getChannel();
-        if (auto* eon = dynamic_cast<EON*>(runningApp.get())) return eon->getChannel();
+long long Waydroid::prewarm(Channels ch) {
+    App* app = appFor(ChannelUtil::appFor(ch));
+    if (!app || app->isRunning() || !foregroundApp || Cancel::requested()) return -1;
+
+    Log::info() << "Prewarming " << app->package() << " for " << ChannelUtil::name(ch);
+    // Nobody should watch the other app start; standby() blanks again, which is harmless
+    runHook("WAYPI_BLANK_CMD");
+    // A viewer's key cancels the start at its next wait or key chunk
+    auto begin = std::chrono::steady_clock::now();
+    app->start();
+    long long startMs = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - begin).count();
+
+    // Back to what was playing; the new app stays resident behind it.
+    // Both apps must end up in a known state, so this part always runs.
+    const bool cancelled = Cancel::requested();
+    Cancel::Scope uncancellable{Cancel::Token()};
+    if (cancelled) {
+        // Half navigated: not worth keeping
+        Log::info() << "Prewarm of " << app->package() << " cancelled after " << startMs << " ms";
+        app->stop();
     }
-    return currentChannel; // fallback to last requested channel
+    if (!foregroundApp->resume()) foregroundApp->start();
+    if (cancelled) runHook("WAYPI_UNBLANK_CMD");
+    return cancelled ? -1 : startMs;
 }
 
-void Waydroid::handleKeyboardInput() {
-    struct termios old_tio, new_tio;
-    
-    // Get current terminal settings
-    tcgetattr(STDIN_FILENO, &old_tio);
-    new_tio = old_tio;
-    
-    // Disable canonical mode and echo
-    new_tio.c_lflag &= (~ICANON & ~ECHO);
-    tcsetattr(STDIN_FILENO, TCSANOW, &new_tio);
-    
-    std::cout << "Keyboard control active. Use arrow keys, Enter, and Esc for Back. Press 'q' to quit." << std::endl;
-    
-    char ch;
-    while (true) {
-        ch = getchar();
-        
-        // Check for escape (Esc key or arrow key escape sequence)
-        if (ch == 27) { // ESC
-            // Wait briefly to see if this is an arrow sequence (Esc '[' ...)
-            fd_set rfds;
-            FD_ZERO(&rfds);
-            FD_SET(STDIN_FILENO, &rfds);
-            timeval tv{0, 50000}; // 50ms
-            int rv = select(STDIN_FILENO + 1, &rfds, nullptr, nullptr, &tv);
-
-            if (rv == 1) {
-                int next = getchar();
-                if (next == '[') {
-                    int arrow = getchar(); // The actual arrow key code
-                    switch (arrow) {
-                        case 'A': // Up arrow
-                            system("adb shell input keyevent KEYCODE_DPAD_UP");
-                            break;
-                        case 'B': // Down arrow
-                            system("adb shell input keyevent KEYCODE_DPAD_DOWN");
-                            break;
-                        case 'C': // Right arrow
-                            system("adb shell input keyevent KEYCODE_DPAD_RIGHT");
-                            break;
-                        case 'D': // Left arrow
-                            system("adb shell input keyevent KEYCODE_DPAD_LEFT");
-                            break;
-                        default:
-                            break;
-                    }
-                } else {
-                    // Not an arrow sequence -> treat as Back; put char back for next loop
-                    if (next != EOF) ungetc(next, stdin);
-                    system("adb shell input keyevent KEYCODE_BACK");
-                }
-            } else {
-                // Timeout: plain Esc key -> Back
-                system("adb shell input keyevent KEYCODE_BACK");
-            }
-            continue;
-        }
-        else if (ch == '\n' || ch == '\r') { // Enter key
-            system("adb shell input keyevent KEYCODE_DPAD_CENTER"); // Power button
-        }
-        else if (ch == 'q' || ch == 'Q') { // Quit
-            std::cout << "Quitting keyboard control..." << std::endl;
-            break;
-        }
-        
-        // Small delay to prevent overwhelming the system
-        usleep(50000); // 50ms delay
+/// @brief The pooled app for `id`, created on first use (nullptr for unknown apps)
+App* Waydroid::appFor(ChannelUtil::AppId id) {
+    auto it = apps.find(id);
+    if (it != apps.end()) return it->second.get();
+
+    std::unique_ptr<App> app;
+    if (id == ChannelUtil::AppId::SVT) {
+        app = std::make_unique<SVT>(adbShell, keyInjector);
+    } else if (id == ChannelUtil::AppId::EON) {
+        app = std::make_unique<EON>(adbShell, keyInjector);
+    } else {
+        return nullptr;
     }
-    
-    // Restore original terminal settings
-    tcsetattr(STDIN_FILENO, TCSANOW, &old_tio);
+    return apps.emplace(id, std::move(app)).first->second.get();
+}
+
+Channels Waydroid::getChannel() {
+    {
+        // While starting, +/- step from the queued channel
+        std::lock_guard<std::mutex> lock(pendingMtx);
+        if (pendingChannel) return *pendingChannel;
+    }
+    if (foregroundApp) return foregroundApp->getChannel();
+    return currentChannel; // fallback to last requested channel
 }
 
 bool Waydroid::showUI() {
     // If we already have a UI pid and it's alive, do nothing
     if (uiPid > 0 && kill(uiPid, 0) == 0) return true;
 
-    // Launch and capture PID using a shell
-    std::unique_ptr<FILE, decltype(&pclose)> pipe(popen(
-        "sh -c 'nohup waydroid show-full-ui >/dev/null 2>&1 & echo $!'", "r"), pclose);
-    if (!pipe) return false;
-
-    std::cout << "UI start command issued" << std::endl;
+    // The window stays open after this returns; the child is reaped when it closes
+    uiPid = ProcessRunner::spawnDetached({"waydroid", "show-full-ui"});
+    if (uiPid <= 0) return false;
 
-    char buf[64] = {0};
-    if (!fgets(buf, sizeof(buf), pipe.get())) return false;
-
-    uiPid = static_cast<pid_t>(strtol(buf, nullptr, 10));
-    if (uiPid <= 0) {
-        // Fallback: leave unknown pid but still consider UI requested
-        uiPid = -1;
-    }
+    Log::info() << "UI start command issued";
     return true;
 }
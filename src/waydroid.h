@@ -11,54 +11,106 @@
 #include <array>
 #include <algorithm>
 #include <cctype>
-#include <termios.h>
 #include <unistd.h>
 #include <cstdio>
 #include <sys/types.h> // pid_t
+#include <atomic>
+#include <mutex>
+#include <optional>
+#include <map>
 
 #include "channels.h"
 #include "App.h"
+#include "adbclient.h"
+#include "adbconnection.h"
+#include "adbshell.h"
+#include "keyinjector.h"
+#include "statusmonitor.h"
 #include "Apps/SVT.h"
 #include "Apps/EON.h"
 
 class Waydroid {
 private:
-    std::string sessionStatus = "UNKNOWN";
-    std::string containerStatus = "UNKNOWN";
-    std::string ipAddress = "UNKNOWN";
-    bool adbConnected = false;
+    StatusMonitor status; // session/container state, kept current in the background
+    std::atomic<bool> frozen{false};
+    AdbClient adbClient;
+    AdbShell adbShell{adbClient}; // persistent session, opened by connectAdb()
+    KeyInjector keyInjector{adbShell}; // resident helper, deployed by start()
+    // Keepalive + reconnect; a lost link also means the container may be gone.
+    // Declared after what its callbacks use, so its thread stops first.
+    AdbConnection adbLink{[this] { status.poke(); }, [this] { keyInjector.restore(); }};
 
-    std::unique_ptr<App> runningApp = nullptr;
+    // Warm pool: every app that has been used stays resident until stop()
+    std::map<ChannelUtil::AppId, std::unique_ptr<App>> apps;
+    App* foregroundApp = nullptr;
     Channels currentChannel{Channels::SVT1};
-    
-    void parseStatus();
-    std::string executeCommand(const std::string& command);
-    std::string trim(const std::string& str);
+
+    // Channel requested while starting; only the latest one is kept
+    std::atomic<bool> starting{false};
+    std::optional<Channels> pendingChannel;
+    std::mutex pendingMtx;
+
+    std::optional<Channels> takePendingChannel();
+    std::optional<Channels> takePendingOrFinishStart();
+    App* appFor(ChannelUtil::AppId id);
+    void runHook(const char* name);
+
+    std::string adbSerial() const { return status.current()->adbSerial(); }
 
 public:
     Waydroid();
     ~Waydroid();
 
     bool start();
+    // Marks a start as underway before start() runs, so channel requests are deferred
+    void markStarting() { starting = true; }
+    bool isStarting() const { return starting; }
     bool stop();
-    bool isRunning();
+    // Standby keeps the session, adb and app state but freezes the container
+    // and blanks the screen; resume() brings it back in well under a second
+    bool standby();
+    bool resume();
+    bool isStandby() const { return frozen; }
+    bool isRunning() const;
     void connectAdb();
     void disconnectAdb();
-    bool isConnectedAdb();
+    bool isConnectedAdb() const;
+    // adb was connected and is kept up (it may be reconnecting right now)
+    bool hasAdbLink() const { return adbLink.isWanted(); }
+    // Holds a caller while a dropped adb link is being re-established
+    bool waitForAdb(int timeoutMs) { return adbLink.waitUntilUp(timeoutMs); }
+    AdbConnection::Stats adbStats() const { return adbLink.stats(); }
+    AdbShell& shell() { return adbShell; }
+    KeyInjector& keys() { return keyInjector; }
     
     void setChannel(Channels ch);
+
+    // How the last setChannel() brought its app to the front
+    enum class AppSwitch { None, Resumed, Started };
+    AppSwitch lastAppSwitch() const { return appSwitch; }
+    long long lastAppSwitchMs() const { return appSwitchMs; }
+
+    // Cold-starts the app owning `ch` behind the foreground app, so a later
+    // switch to it is a warm resume. The start takes the screen, so this is
+    // only run on the way into standby, with the display blanked
+    // (WAYPI_BLANK_CMD). Returns the start time in ms, or -1 if there was
+    // nothing to do (app already resident, nothing playing) or it was
+    // cancelled. A cancelled prewarm stops the half-started app, brings the
+    // foreground app back and unblanks the display before returning.
+    long long prewarm(Channels ch);
+    // Queues the channel while starting; returns false once starting is over
+    bool deferChannel(Channels ch);
     Channels getChannel();
 
-    // [DEBUG] Keyboard input handling
-    void handleKeyboardInput();
-    
     // Getters for the parsed status information
-    const std::string& getSessionStatus() const { return sessionStatus; }
-    const std::string& getContainerStatus() const { return containerStatus; }
-    const std::string& getIpAddress() const { return ipAddress; }
+    std::string getSessionStatus() const { return status.current()->session; }
+    std::string getContainerStatus() const { return status.current()->container; }
+    std::string getIpAddress() const { return status.current()->ip; }
 
 private:
     pid_t uiPid = -1;
+    AppSwitch appSwitch = AppSwitch::None;
+    long long appSwitchMs = 0;
 
     bool showUI();   // open the UI window (full UI)
 };
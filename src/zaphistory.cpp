@@ -0,0 +1,136 @@
+#include "zaphistory.h"
+#include "log.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <utility>
+
+namespace {
+    const size_t kMaxZaps = 2000;
+    // A prediction needs this much weighted support and this share of the
+    // zaps out of `from`; below that, guessing would mostly waste work
+    const int kMinScore = 3;
+    const double kMinShare = 0.4;
+
+    std::optional<Channels> channelNamed(const std::string& name) {
+        for (Channels ch : ChannelUtil::all) {
+            if (name == ChannelUtil::name(ch)) return ch;
+        }
+        return std::nullopt;
+    }
+
+    int hourOf(std::time_t when) {
+        std::tm local{};
+        localtime_r(&when, &local);
+        return local.tm_hour;
+    }
+
+    // Same hour counts 3, an adjacent hour 2, any other hour 1
+    int weight(int hourA, int hourB) {
+        int d = std::abs(hourA - hourB);
+        d = std::min(d, 24 - d);
+        return d == 0 ? 3 : (d == 1 ? 2 : 1);
+    }
+
+    std::optional<Channels> predictFrom(const std::deque<ZapHistory::Zap>& zaps, size_t count,
+                                        Channels from, std::time_t when) {
+        const int hour = hourOf(when);
+        std::map<Channels, int> scores;
+        int total = 0;
+        for (size_t i = 0; i < count; ++i) {
+            if (zaps[i].from != from) continue;
+            int w = weight(hour, hourOf(zaps[i].when));
+            scores[zaps[i].to] += w;
+            total += w;
+        }
+
+        std::optional<Channels> best;
+        int bestScore = 0;
+        for (const auto& pair : scores) {
+            if (pair.second > bestScore) {
+                best = pair.first;
+                bestScore = pair.second;
+            }
+        }
+        if (!best || bestScore < kMinScore || bestScore < kMinShare * total) return std::nullopt;
+        return best;
+    }
+}
+
+std::string ZapHistory::defaultPath() {
+    if (const char* file = std::getenv("WAYPI_ZAP_HISTORY")) return file;
+    const char* home = std::getenv("HOME");
+    return std::string(home ? home : ".") + "/.waypi-zaps.tsv";
+}
+
+ZapHistory::ZapHistory(std::string file) : path(std::move(file)) {
+    load();
+}
+
+void ZapHistory::load() {
+    std::ifstream in(path);
+    if (!in) return;
+
+    size_t lines = 0;
+    std::string line;
+    while (std::getline(in, line)) {
+        ++lines;
+        std::istringstream fields(line);
+        std::string when, from, to;
+        if (!std::getline(fields, when, '\t') || !std::getline(fields, from, '\t') ||
+            !std::getline(fields, to, '\t')) continue;
+
+        auto fromCh = channelNamed(from);
+        auto toCh = channelNamed(to);
+        if (!fromCh || !toCh) continue; // channel renamed or removed
+        zaps.push_back(Zap{static_cast<std::time_t>(std::atoll(when.c_str())), *fromCh, *toCh});
+        if (zaps.size() > kMaxZaps) zaps.pop_front();
+    }
+    Log::info() << "Zap history: " << zaps.size() << " zaps from " << path;
+
+    if (lines > 2 * kMaxZaps) compact();
+}
+
+// Rewrites the file with only the zaps kept in memory
+void ZapHistory::compact() {
+    std::ofstream out(path, std::ios::trunc);
+    for (const auto& zap : zaps) {
+        out << zap.when << '\t' << ChannelUtil::name(zap.from) << '\t' << ChannelUtil::name(zap.to) << '\n';
+    }
+}
+
+void ZapHistory::record(Channels from, Channels to, std::time_t when) {
+    if (from == to) return;
+
+    zaps.push_back(Zap{when, from, to});
+    if (zaps.size() > kMaxZaps) zaps.pop_front();
+
+    std::ofstream out(path, std::ios::app);
+    if (!out) {
+        Log::error() << "Cannot write zap history to " << path;
+        return;
+    }
+    out << when << '\t' << ChannelUtil::name(from) << '\t' << ChannelUtil::name(to) << '\n';
+}
+
+std::optional<Channels> ZapHistory::predict(Channels from, std::time_t when) const {
+    return predictFrom(zaps, zaps.size(), from, when);
+}
+
+void ZapHistory::printReplay(std::ostream& out) const {
+    size_t predicted = 0;
+    size_t hits = 0;
+    for (size_t i = 0; i < zaps.size(); ++i) {
+        auto guess = predictFrom(zaps, i, zaps[i].from, zaps[i].when);
+        if (!guess) continue;
+        ++predicted;
+        if (*guess == zaps[i].to) ++hits;
+    }
+
+    out << zaps.size() << " zaps in history, " << predicted << " predicted, " << hits << " correct";
+    if (predicted > 0) out << " (" << (100 * hits / predicted) << "% hit rate)";
+    out << std::endl;
+}
@@ -0,0 +1,45 @@
+// On-disk zap history and a next-channel predictor built from it.
+// Each zap (local time, from -> to) is appended to a small TSV file. The
+// prediction for "what comes after `from` at this hour" is the destination
+// seen most often from `from`, with zaps at nearby hours of day weighted up.
+#ifndef ZAPHISTORY_H
+#define ZAPHISTORY_H
+
+#include <ctime>
+#include <deque>
+#include <optional>
+#include <ostream>
+#include <string>
+
+#include "channels.h"
+
+class ZapHistory {
+public:
+    struct Zap {
+        std::time_t when;
+        Channels from;
+        Channels to;
+    };
+
+private:
+    std::string path;
+    std::deque<Zap> zaps; // oldest first, at most kMaxZaps
+
+    void load();
+    void compact();
+
+public:
+    // WAYPI_ZAP_HISTORY, or ~/.waypi-zaps.tsv
+    static std::string defaultPath();
+
+    explicit ZapHistory(std::string file = defaultPath());
+
+    void record(Channels from, Channels to, std::time_t when = std::time(nullptr));
+    std::optional<Channels> predict(Channels from, std::time_t when = std::time(nullptr)) const;
+    size_t size() const { return zaps.size(); }
+
+    // Replays the history in order, predicting each zap from the ones before it
+    void printReplay(std::ostream& out) const;
+};
+
+#endif
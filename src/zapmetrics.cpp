@@ -0,0 +1,142 @@
+#include "zapmetrics.h"
+#include "log.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+
+namespace {
+    // Quantiles are taken over this many recent zaps per series
+    const size_t kMaxSamples = 256;
+
+    double seconds(ZapTrace::Clock::duration d) {
+        return std::chrono::duration<double>(d).count();
+    }
+
+    long long ms(ZapTrace::Clock::duration d) {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(d).count();
+    }
+
+    template <typename Map, typename Labels>
+    void writeSummary(std::ostream& out, const char* metric, const char* help, const Map& series, Labels labels) {
+        out << "# HELP " << metric << "_seconds " << help << "\n"
+            << "# TYPE " << metric << "_seconds summary\n";
+        for (const auto& entry : series) {
+            const std::string l = labels(entry.first);
+            out << metric << "_seconds{" << l << ",quantile=\"0.5\"} " << entry.second.quantile(0.5) << "\n"
+                << metric << "_seconds{" << l << ",quantile=\"0.95\"} " << entry.second.quantile(0.95) << "\n"
+                << metric << "_seconds_sum{" << l << "} " << entry.second.sum << "\n"
+                << metric << "_seconds_count{" << l << "} " << entry.second.count << "\n";
+        }
+        out << "# HELP " << metric << "_max_seconds Slowest " << help << "\n"
+            << "# TYPE " << metric << "_max_seconds gauge\n";
+        for (const auto& entry : series) {
+            out << metric << "_max_seconds{" << labels(entry.first) << "} " << entry.second.max << "\n";
+        }
+    }
+}
+
+void ZapTrace::add(const std::string& stage, Clock::duration elapsed) {
+    for (auto& entry : stages) {
+        if (entry.first == stage) {
+            entry.second += elapsed;
+            return;
+        }
+    }
+    stages.emplace_back(stage, elapsed);
+}
+
+void ZapTrace::note(const char* stage, Clock::time_point begin) {
+    if (current) current->add(stage, Clock::now() - begin);
+}
+
+void ZapTrace::countKeys(unsigned long n) {
+    if (current) current->keyCount += n;
+}
+
+void ZapMetrics::Series::add(double value) {
+    samples.push_back(value);
+    if (samples.size() > kMaxSamples) samples.pop_front();
+    sum += value;
+    ++count;
+    max = std::max(max, value);
+}
+
+double ZapMetrics::Series::quantile(double q) const {
+    if (samples.empty()) return 0;
+    std::vector<double> sorted(samples.begin(), samples.end());
+    size_t rank = static_cast<size_t>(q * (sorted.size() - 1) + 0.5);
+    std::nth_element(sorted.begin(), sorted.begin() + rank, sorted.end());
+    return sorted[rank];
+}
+
+std::string ZapMetrics::defaultPath() {
+    const char* file = std::getenv("WAYPI_METRICS_FILE");
+    return file ? file : "";
+}
+
+ZapMetrics::ZapMetrics(std::string file) : path(std::move(file)) {
+    if (!path.empty()) Log::info() << "Zap metrics: writing " << path;
+}
+
+void ZapMetrics::setAdbStats(unsigned long reconnects, long long downtimeMs) {
+    adbReconnects = reconnects;
+    adbDowntimeMs = downtimeMs;
+}
+
+/// @brief Adds every stage of `trace` plus "total" (press to live) to the pair
+/// and app series, and logs the breakdown
+void ZapMetrics::record(Channels from, Channels to, const ZapTrace& trace) {
+    const auto total = ZapTrace::Clock::now() - trace.pressed();
+    const std::string fromName = ChannelUtil::name(from);
+    const std::string toName = ChannelUtil::name(to);
+    const std::string app = ChannelUtil::appName(ChannelUtil::appFor(to));
+
+    {
+        Log::Line line(Log::Level::Info);
+        line << "Zap " << fromName << " -> " << toName << ": " << ms(total) << " ms (";
+        for (const auto& stage : trace.getStages()) {
+            byPair[std::make_tuple(stage.first, fromName, toName)].add(seconds(stage.second));
+            byApp[std::make_pair(stage.first, app)].add(seconds(stage.second));
+            line << stage.first << " " << ms(stage.second) << ", ";
+        }
+        line << trace.keys() << (trace.keys() == 1 ? " key)" : " keys)");
+    }
+    byPair[std::make_tuple("total", fromName, toName)].add(seconds(total));
+    byApp[std::make_pair("total", app)].add(seconds(total));
+
+    write();
+}
+
+/// @brief Rewrites the textfile; written beside it and renamed, so a scrape
+/// never sees half a file
+void ZapMetrics::write() const {
+    if (path.empty()) return;
+
+    const std::string tmp = path + ".tmp";
+    {
+        std::ofstream out(tmp, std::ios::trunc);
+        if (!out) {
+            Log::error() << "Cannot write zap metrics to " << tmp;
+            return;
+        }
+        writeSummary(out, "waypi_zap_stage", "zap stage latency per channel pair", byPair,
+                     [](const std::tuple<std::string, std::string, std::string>& key) {
+            return "stage=\"" + std::get<0>(key) + "\",from=\"" + std::get<1>(key) + "\",to=\"" + std::get<2>(key) + "\"";
+        });
+        writeSummary(out, "waypi_app_stage", "zap stage latency per destination app", byApp,
+                     [](const std::pair<std::string, std::string>& key) {
+            return "stage=\"" + key.first + "\",app=\"" + key.second + "\"";
+        });
+        out << "# HELP waypi_adb_reconnects_total adb link outages recovered from\n"
+            << "# TYPE waypi_adb_reconnects_total counter\n"
+            << "waypi_adb_reconnects_total " << adbReconnects << "\n"
+            << "# HELP waypi_adb_downtime_seconds_total Time the adb link was down\n"
+            << "# TYPE waypi_adb_downtime_seconds_total counter\n"
+            << "waypi_adb_downtime_seconds_total " << adbDowntimeMs / 1000.0 << "\n";
+    }
+    if (std::rename(tmp.c_str(), path.c_str()) != 0) {
+        Log::error() << "Cannot replace " << path;
+    }
+}
@@ -0,0 +1,90 @@
+// End-to-end zap latency, from the key press to the channel being live.
+// A ZapTrace follows one channel change. The controller binds it to the
+// worker thread, and the code doing the work (app switch, key injection,
+// waits) adds its time to named stages. ZapMetrics keeps per-stage
+// summaries per channel pair and per app and can write them as a
+// Prometheus textfile (WAYPI_METRICS_FILE) for node_exporter.
+#ifndef ZAPMETRICS_H
+#define ZAPMETRICS_H
+
+#include <chrono>
+#include <deque>
+#include <map>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "channels.h"
+
+class ZapTrace {
+public:
+    using Clock = std::chrono::steady_clock;
+
+private:
+    Clock::time_point pressedAt;
+    // Stage -> accumulated time, in the order stages first appeared
+    std::vector<std::pair<std::string, Clock::duration>> stages;
+    unsigned long keyCount = 0;
+
+    inline static thread_local ZapTrace* current = nullptr;
+
+public:
+    explicit ZapTrace(Clock::time_point pressed) : pressedAt(pressed) {}
+
+    void add(const std::string& stage, Clock::duration elapsed);
+    Clock::time_point pressed() const { return pressedAt; }
+    const std::vector<std::pair<std::string, Clock::duration>>& getStages() const { return stages; }
+    unsigned long keys() const { return keyCount; }
+
+    // Binds a trace to this thread for the lifetime of the scope
+    class Scope {
+    private:
+        ZapTrace* previous;
+
+    public:
+        explicit Scope(ZapTrace& trace) : previous(current) { current = &trace; }
+        ~Scope() { current = previous; }
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+    };
+
+    // Adds the time since `begin` to `stage` of the bound trace, if any
+    static void note(const char* stage, Clock::time_point begin);
+    static void countKeys(unsigned long n);
+};
+
+class ZapMetrics {
+private:
+    struct Series {
+        std::deque<double> samples; // seconds, the last kMaxSamples
+        double sum = 0;
+        unsigned long count = 0;
+        double max = 0;
+
+        void add(double seconds);
+        double quantile(double q) const;
+    };
+
+    std::string path;
+    // (stage, from, to) and (stage, app)
+    std::map<std::tuple<std::string, std::string, std::string>, Series> byPair;
+    std::map<std::pair<std::string, std::string>, Series> byApp;
+    unsigned long adbReconnects = 0;
+    long long adbDowntimeMs = 0;
+
+    void write() const;
+
+public:
+    // WAYPI_METRICS_FILE, or empty (no file)
+    static std::string defaultPath();
+
+    explicit ZapMetrics(std::string file = defaultPath());
+
+    // Records a zap that went live now, logs it and rewrites the textfile
+    void record(Channels from, Channels to, const ZapTrace& trace);
+    // Exported alongside the zap stages
+    void setAdbStats(unsigned long reconnects, long long downtimeMs);
+};
+
+#endif